@@ -0,0 +1,118 @@
+// Throughput of the FIR kernels in dsp/utils/fir_kernels.h for every SIMD flavour the CPU
+// supports, next to the one volk call per output the blocks used before, and the fixed
+// point kernel for complex_int16.
+//
+// Usage: fir_bench [outputs per call]
+#include <dsp/utils/fir_kernels.h>
+#include <volk/volk.h>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_MIN_TIME_NS   200000000ULL
+
+using namespace dsp;
+
+template <class Func>
+double nsPerTap(int tapCount, int count, Func func) {
+    uint64_t taps = 0;
+    auto start = std::chrono::steady_clock::now();
+    uint64_t elapsed = 0;
+    while (elapsed < BENCH_MIN_TIME_NS) {
+        func();
+        taps += (uint64_t)tapCount * count;
+        elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    return (double)elapsed / (double)taps;
+}
+
+const char* levelName(fir_kernels::simd_level level) {
+    switch (level) {
+        case fir_kernels::SIMD_SSE:     return "sse";
+        case fir_kernels::SIMD_AVX2:    return "avx2";
+        case fir_kernels::SIMD_AVX512:  return "avx512";
+        case fir_kernels::SIMD_NEON:    return "neon";
+        default:                        return "generic";
+    }
+}
+
+template <class T>
+void bench(const char* type, int tapCount, int count, std::vector<fir_kernels::simd_level>& levels) {
+    std::vector<T> in(count + tapCount);
+    std::vector<T> out(count);
+    std::vector<float> taps(tapCount);
+    for (auto& v : in) { for (int i = 0; i < (int)(sizeof(T) / sizeof(float)); i++) { ((float*)&v)[i] = (float)rand() / (float)RAND_MAX; } }
+    for (auto& t : taps) { t = (float)rand() / (float)RAND_MAX; }
+
+    printf("%-8s %5d taps   volk %7.3f", type, tapCount, nsPerTap(tapCount, count, [&]() {
+        for (int i = 0; i < count; i++) {
+            if constexpr (std::is_same_v<T, float>) {
+                volk_32f_x2_dot_prod_32f(&out[i], &in[i], taps.data(), tapCount);
+            }
+            else {
+                volk_32fc_32f_dot_prod_32fc((lv_32fc_t*)&out[i], (lv_32fc_t*)&in[i], taps.data(), tapCount);
+            }
+        }
+    }));
+
+    for (auto level : levels) {
+        fir_kernels::setSIMDLevel(level);
+        double plain = nsPerTap(tapCount, count, [&]() {
+            fir_kernels::dot(out.data(), in.data(), taps.data(), tapCount, count);
+        });
+        if (level != fir_kernels::SIMD_GENERIC) {
+            printf("   %s %6.3f/     -", levelName(level), plain);
+            continue;
+        }
+        // The symmetric kernel only exists in generic code
+        double symmetric = nsPerTap(tapCount, count, [&]() {
+            fir_kernels::symmetric(out.data(), in.data(), taps.data(), tapCount, count);
+        });
+        printf("   %s %6.3f/%6.3f", levelName(level), plain, symmetric);
+    }
+    printf("\n");
+}
+
+// Fixed point kernel on complex_int16, no volk equivalent
+void benchFixed(int tapCount, int count, std::vector<fir_kernels::simd_level>& levels) {
+    std::vector<complex_int16> in(count + tapCount);
+    std::vector<complex_int16> out(count);
+    std::vector<float> taps(tapCount);
+    for (auto& v : in) { v = { (int16_t)(rand() - (RAND_MAX / 2)), (int16_t)(rand() - (RAND_MAX / 2)) }; }
+    for (auto& t : taps) { t = (float)rand() / (float)RAND_MAX / (float)tapCount; }
+    int shift = fir_kernels::fixedTapShift(taps.data(), tapCount);
+    std::vector<int16_t> packed(2 * tapCount);
+    fir_kernels::packFixedTaps(packed.data(), taps.data(), tapCount, shift);
+
+    printf("%-8s %5d taps   volk       -", "int16", tapCount);
+    for (auto level : levels) {
+        fir_kernels::setSIMDLevel(level);
+        double plain = nsPerTap(tapCount, count, [&]() {
+            fir_kernels::dotFixed(out.data(), in.data(), packed.data(), tapCount, shift, count);
+        });
+        printf("   %s %6.3f/     -", levelName(level), plain);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    int count = (argc > 1) ? atoi(argv[1]) : 8192;
+
+    fir_kernels::simd_level best = fir_kernels::detectSIMD();
+    std::vector<fir_kernels::simd_level> levels = { fir_kernels::SIMD_GENERIC };
+    if (best == fir_kernels::SIMD_NEON) {
+        levels.push_back(fir_kernels::SIMD_NEON);
+    }
+    else {
+        for (int l = fir_kernels::SIMD_SSE; l <= best; l++) { levels.push_back((fir_kernels::simd_level)l); }
+    }
+
+    printf("ns per tap per output, %d outputs per call, plain/symmetric kernel\n", count);
+    int tapCounts[] = { 8, 32, 127, 255, 511, 1024 };
+    for (int tapCount : tapCounts) { bench<float>("float", tapCount, count, levels); }
+    for (int tapCount : tapCounts) { bench<complex_t>("complex", tapCount, count, levels); }
+    for (int tapCount : tapCounts) { benchFixed(tapCount, count, levels); }
+
+    return 0;
+}
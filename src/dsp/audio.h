@@ -10,6 +10,7 @@ namespace dsp {
 
         void init(stream<float>* in) {
             _in = in;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<MonoToStereo>::registerInput(_in);
             generic_block<MonoToStereo>::registerOutput(&out);
         }
@@ -29,6 +30,7 @@ namespace dsp {
 
             volk_32f_x2_interleave_32fc((lv_32fc_t*)out.writeBuf, _in->readBuf, _in->readBuf, count);
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -50,6 +52,7 @@ namespace dsp {
         void init(stream<float>* in_left, stream<float>* in_right) {
             _in_left = in_left;
             _in_right = in_right;
+            out.setBufferSize(_in_left->getBufferSize());
             generic_block<ChannelsToStereo>::registerInput(_in_left);
             generic_block<ChannelsToStereo>::registerInput(_in_right);
             generic_block<ChannelsToStereo>::registerOutput(&out);
@@ -79,6 +82,8 @@ namespace dsp {
 
             volk_32f_x2_interleave_32fc((lv_32fc_t*)out.writeBuf, _in_left->readBuf, _in_right->readBuf, count_l);
 
+            // Tags come from the left channel
+            forwardTags(_in_left, &out, count_l);
             _in_left->flush();
             _in_right->flush();
             if (!out.swap(count_l)) { return -1; }
@@ -99,16 +104,9 @@ namespace dsp {
 
         StereoToMono(stream<stereo_t>* in) { init(in); }
 
-        ~StereoToMono() {
-            generic_block<StereoToMono>::stop();
-            delete[] l_buf;
-            delete[] r_buf;
-        }
-
         void init(stream<stereo_t>* in) {
             _in = in;
-            l_buf = new float[STREAM_BUFFER_SIZE];
-            r_buf = new float[STREAM_BUFFER_SIZE];
+            out.setBufferSize(_in->getBufferSize());
             generic_block<StereoToMono>::registerInput(_in);
             generic_block<StereoToMono>::registerOutput(&out);
         }
@@ -130,6 +128,7 @@ namespace dsp {
                 out.writeBuf[i] = (_in->readBuf[i].l + _in->readBuf[i].r) * 0.5f;
             }
 
+            forwardTags(_in, &out, count);
             _in->flush();
 
             if (!out.swap(count)) { return -1; }
@@ -139,7 +138,6 @@ namespace dsp {
         stream<float> out;
 
     private:
-        float* l_buf, *r_buf;
         stream<stereo_t>* _in;
 
     };
@@ -152,6 +150,8 @@ namespace dsp {
 
         void init(stream<stereo_t>* in) {
             _in = in;
+            out_left.setBufferSize(_in->getBufferSize());
+            out_right.setBufferSize(_in->getBufferSize());
             generic_block<StereoToChannels>::registerInput(_in);
             generic_block<StereoToChannels>::registerOutput(&out_left);
             generic_block<StereoToChannels>::registerOutput(&out_right);
@@ -172,6 +172,8 @@ namespace dsp {
 
             volk_32fc_deinterleave_32f_x2(out_left.writeBuf, out_right.writeBuf, (lv_32fc_t*)_in->readBuf, count);
 
+            forwardTags(_in, &out_left, count);
+            forwardTags(_in, &out_right, count);
             _in->flush();
             if (!out_left.swap(count)) { return -1; }
             if (!out_right.swap(count)) { return -1; }
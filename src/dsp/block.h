@@ -1,14 +1,55 @@
 #pragma once
 #include <stdio.h>
 #include <dsp/stream.h>
+#include <dsp/utils/mailbox.h>
 #include <dsp/types.h>
 #include <thread>
 #include <vector>
 #include <algorithm>
+#include <chrono>
 
 #include <spdlog/spdlog.h>
 
 namespace dsp {
+    class generic_scheduler;
+
+    struct block_stats {
+        uint64_t runs;          // Calls to run()
+        uint64_t itemsIn;       // Items consumed from all inputs
+        uint64_t itemsOut;      // Items produced on all outputs
+        uint64_t totalNs;       // Time spent in run()
+        uint64_t readWaitNs;    // Part of totalNs spent waiting for input
+        uint64_t swapWaitNs;    // Part of totalNs spent waiting for room on an output
+        uint64_t computeNs;     // Part of totalNs spent doing actual work
+        uint64_t wakes;         // Waits on inputs or outputs that ended
+        uint64_t wakeNs;        // Time from the notifications ending them to the block running again
+
+        block_stats& operator+=(const block_stats& b) {
+            runs += b.runs;
+            itemsIn += b.itemsIn;
+            itemsOut += b.itemsOut;
+            totalNs += b.totalNs;
+            readWaitNs += b.readWaitNs;
+            swapWaitNs += b.swapWaitNs;
+            computeNs += b.computeNs;
+            wakes += b.wakes;
+            wakeNs += b.wakeNs;
+            return *this;
+        }
+    };
+
+    // Copies the tags of the buffer read from in to the same items of out, for blocks that make
+    // one output per input. Call between in->read() and in->flush(), before swapping out, with
+    // count being the number of outputs. Tags past the last output go on it.
+    template <class IN, class OUT>
+    inline void forwardTags(stream<IN>* in, stream<OUT>* out, int count) {
+        const std::vector<stream_tag>& tags = in->getReadTags();
+        if (tags.empty() || count <= 0) { return; }
+        uint64_t inOffset = in->getReadOffset();
+        for (auto& tag : tags) {
+            out->addTag(std::min<int64_t>(tag.offset - inOffset, count - 1), tag.key, tag.value);
+        }
+    }
 
     class generic_unnamed_block {
     public:
@@ -16,6 +57,25 @@ namespace dsp {
         virtual void stop() {}
         virtual int calcOutSize(int inSize) { return inSize; }
         virtual int run() { return -1; }
+        virtual void setScheduler(generic_scheduler* sched) {}
+
+        // run() with its time accounted for in the block's stats, used by whatever drives the block
+        virtual int timedRun() { return run(); }
+
+        // Called by whatever drives the block once run() returned -1
+        virtual void runEnded() {}
+
+        // Wait for the block to be done, either stopped or because its inputs ended
+        virtual void wait() {}
+
+        virtual block_stats getStats() { return block_stats{}; }
+    };
+
+    // Runs the run() function of the blocks attached to it on threads it manages
+    class generic_scheduler {
+    public:
+        virtual void attach(generic_unnamed_block* block, const std::vector<untyped_steam*>& inputs, const std::vector<untyped_steam*>& outputs) = 0;
+        virtual void detach(generic_unnamed_block* block) = 0;
     };
     
     template <class BLOCK>
@@ -33,6 +93,7 @@ namespace dsp {
                 return;
             }
             running = true;
+            beginRun();
             doStart();
         }
 
@@ -41,19 +102,105 @@ namespace dsp {
             if (!running) {
                 return;
             }
+            stopping = true;
             doStop();
+            endRun();
             running = false;
         }
 
         virtual int calcOutSize(int inSize) { return inSize; }
 
         virtual int run() = 0;
+
+        // If run() returned -1 on its own, the inputs ended (or a source ran out), so let the
+        // block finish up and end the outputs too
+        void runEnded() {
+            if (!stopping) {
+                finish();
+                for (auto& out : outputs) {
+                    out->sendEOS();
+                }
+            }
+            endRun();
+        }
+
+        void wait() {
+            finishEvent.wait([this]{ return finished.load(std::memory_order_acquire); });
+        }
+
+        // Run on a shared scheduler instead of a dedicated thread, NULL to get a dedicated thread back
+        virtual void setScheduler(generic_scheduler* sched) {
+            std::lock_guard<std::mutex> lck(ctrlMtx);
+            tempStop();
+            _sched = sched;
+            tempStart();
+        }
+
+        int timedRun() {
+            auto start = std::chrono::steady_clock::now();
+            int ret = run();
+            auto end = std::chrono::steady_clock::now();
+            uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            runCount.store(runCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            runNs.store(runNs.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+            if (trace::isEnabled()) { trace::record(traceName(), this, start, end); }
+            return ret;
+        }
+
+        // Snapshot of the counters since the block was created. Item counts and wait
+        // times come from the registered streams.
+        block_stats getStats() {
+            std::lock_guard<std::mutex> lck(ctrlMtx);
+            block_stats stats{};
+            stats.runs = runCount.load(std::memory_order_relaxed);
+            stats.totalNs = runNs.load(std::memory_order_relaxed);
+            for (auto& in : inputs) {
+                stream_stats s = in->getStats();
+                stats.itemsIn += s.readItems;
+                stats.readWaitNs += s.readerWaitNs;
+                stats.wakes += s.readerWakes;
+                stats.wakeNs += s.readerWakeNs;
+            }
+            for (auto& out : outputs) {
+                stream_stats s = out->getStats();
+                stats.itemsOut += s.writtenItems;
+                stats.swapWaitNs += s.writerWaitNs;
+                stats.wakes += s.writerWakes;
+                stats.wakeNs += s.writerWakeNs;
+            }
+            uint64_t waitNs = stats.readWaitNs + stats.swapWaitNs;
+            stats.computeNs = (stats.totalNs > waitNs) ? (stats.totalNs - waitNs) : 0;
+            return stats;
+        }
         
         friend BLOCK;
 
     private:
         void workerLoop() { 
-            while (run() >= 0);
+            for (auto& in : inputs) { in->readerStarted(); }
+            while (timedRun() >= 0);
+            runEnded();
+        }
+
+        // Called from the thread running the block once its inputs have ended, before ending its outputs
+        virtual void finish() {}
+
+        void beginRun() {
+            stopping = false;
+            finished.store(false, std::memory_order_release);
+            for (auto& out : outputs) {
+                out->clearEOS();
+            }
+        }
+
+        void endRun() {
+            finished.store(true, std::memory_order_release);
+            finishEvent.notify();
+        }
+
+        static const char* traceName() {
+            static const char* name = trace::typeName(typeid(BLOCK));
+            return name;
         }
 
         void aquire() {
@@ -81,6 +228,10 @@ namespace dsp {
         }
 
         virtual void doStart() {
+            if (_sched) {
+                _sched->attach(this, inputs, outputs);
+                return;
+            }
             workerThread = std::thread(&generic_block<BLOCK>::workerLoop, this);
         }
 
@@ -93,7 +244,10 @@ namespace dsp {
             }
 
             // TODO: Make sure this isn't needed, I don't know why it stops
-            if (workerThread.joinable()) {
+            if (_sched) {
+                _sched->detach(this);
+            }
+            else if (workerThread.joinable()) {
                 workerThread.join();
             }
 
@@ -107,6 +261,7 @@ namespace dsp {
 
         void tempStart() {
             if (tempStopped) {
+                beginRun();
                 doStart();
                 tempStopped = false;
             }
@@ -114,7 +269,9 @@ namespace dsp {
 
         void tempStop() {
             if (running && !tempStopped) {
+                stopping = true;
                 doStop();
+                endRun();
                 tempStopped = true;
             }
         }
@@ -124,8 +281,15 @@ namespace dsp {
 
         bool running = false;
         bool tempStopped = false;
+        std::atomic<bool> stopping{false};
+        std::atomic<bool> finished{true};
+        event finishEvent;
 
         std::thread workerThread;
+        generic_scheduler* _sched = NULL;
+
+        std::atomic<uint64_t> runCount{0};
+        std::atomic<uint64_t> runNs{0};
 
     protected:
         std::mutex ctrlMtx;
@@ -161,6 +325,36 @@ namespace dsp {
 
         virtual int calcOutSize(int inSize) { return inSize; }
 
+        void setScheduler(generic_scheduler* sched) {
+            for (auto& block : blocks) {
+                block->setScheduler(sched);
+            }
+        }
+
+        // Sum of the stats of all the blocks, items include the ones moved between them
+        block_stats getStats() {
+            block_stats stats{};
+            for (auto& block : blocks) {
+                stats += block->getStats();
+            }
+            return stats;
+        }
+
+        void wait() {
+            for (auto& block : blocks) {
+                block->wait();
+            }
+        }
+
+        // Stats of each block, in the order they were registered
+        std::vector<block_stats> getBlockStats() {
+            std::vector<block_stats> stats;
+            for (auto& block : blocks) {
+                stats.push_back(block->getStats());
+            }
+            return stats;
+        }
+
         friend BLOCK;
 
     private:
@@ -14,11 +14,11 @@ namespace dsp {
 
         RingBuffer(int maxLatency) { init(maxLatency); }
 
-        ~RingBuffer() { delete _buffer; }
+        ~RingBuffer() { buffer::free(_buffer); }
 
         void init(int maxLatency) {
             size = RING_BUF_SZ;
-            _buffer = new T[size];
+            _buffer = buffer::alloc<T>(size);
             _stopReader = false;
             _stopWriter = false;
             this->maxLatency = maxLatency;
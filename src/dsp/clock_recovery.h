@@ -2,6 +2,7 @@
 #include <dsp/block.h>
 #include <dsp/utils/macros.h>
 #include <dsp/interpolation_taps.h>
+#include <dsp/utils/fir_kernels.h>
 
 namespace dsp {
     class EdgeTrigClockRecovery : public generic_block<EdgeTrigClockRecovery> {
@@ -83,33 +84,32 @@ namespace dsp {
             omegaMin = _omega - (_omega * _omegaRelLimit);
             omegaMax = _omega + (_omega * _omegaRelLimit);
             _dynOmega = _omega;
+            paramBox.reset({ _omega, _omegaRelLimit, _gainOmega, _muGain, omegaSeq });
 
             generic_block<MMClockRecovery<T>>::registerInput(_in);
             generic_block<MMClockRecovery<T>>::registerOutput(&out);
         }
 
+        // The setters take effect at the start of the next buffer, without stopping the block
         void setOmega(float omega, float omegaRelLimit) {
-            generic_block<MMClockRecovery<T>>::tempStop();
-            omegaMin = _omega - (_omega * _omegaRelLimit);
-            omegaMax = _omega + (_omega * _omegaRelLimit);
-            _omega = omega;
-            _dynOmega = _omega;
-            generic_block<MMClockRecovery<T>>::tempStart();
+            paramBox.update([=](params& p) {
+                p.omega = omega;
+                p.omegaRelLimit = omegaRelLimit;
+                p.omegaSeq++;
+            });
         }
 
         void setGains(float omegaGain, float muGain) {
-            generic_block<MMClockRecovery<T>>::tempStop();
-            _gainOmega = omegaGain;
-            _muGain = muGain;
-            generic_block<MMClockRecovery<T>>::tempStart();
+            paramBox.update([=](params& p) {
+                p.gainOmega = omegaGain;
+                p.muGain = muGain;
+            });
         }
 
         void setOmegaRelLimit(float omegaRelLimit) {
-            generic_block<MMClockRecovery<T>>::tempStop();
-            _omegaRelLimit = omegaRelLimit;
-            omegaMin = _omega - (_omega * _omegaRelLimit);
-            omegaMax = _omega + (_omega * _omegaRelLimit);
-            generic_block<MMClockRecovery<T>>::tempStart();
+            paramBox.update([=](params& p) {
+                p.omegaRelLimit = omegaRelLimit;
+            });
         }
 
         void setInput(stream<T>* in) {
@@ -120,9 +120,10 @@ namespace dsp {
             generic_block<MMClockRecovery<T>>::tempStart();
         }
 
-        int run() {
-            count = _in->read();
-            if (count < 0) { return -1; }
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        // count must be at least 7.
+        int process(int count, const T* in, T* out) {
+            applyParams();
 
             int outCount = 0;
             float outVal;
@@ -131,7 +132,7 @@ namespace dsp {
             int maxOut = 2.0f * _omega * (float)count;
 
             // Copy the first 7 values to the delay buffer for fast computing
-            memcpy(&delay[7], _in->readBuf, 7 * sizeof(T));
+            memcpy(&delay[7], in, 7 * sizeof(T));
 
             int i = nextOffset;
             for (; i < count && outCount < maxOut;) {
@@ -141,12 +142,12 @@ namespace dsp {
                     // If we still need to use the old values, calculate using delay buf
                     // Otherwise, use normal buffer
                     if (i < 7) {
-                        volk_32f_x2_dot_prod_32f(&outVal, &delay[i], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8);
+                        fir_kernels::dot(&outVal, &delay[i], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8, 1);
                     }
                     else {
-                        volk_32f_x2_dot_prod_32f(&outVal, &_in->readBuf[i - 7], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8);
+                        fir_kernels::dot(&outVal, &in[i - 7], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8, 1);
                     }
-                    out.writeBuf[outCount++] = outVal;
+                    out[outCount++] = outVal;
 
                     // Cursed phase detect approximation (don't ask me how this approximation works)
                     phaseError = (DSP_STEP(lastOutput)*outVal) - (lastOutput*DSP_STEP(outVal));
@@ -162,12 +163,12 @@ namespace dsp {
 
                     // Perfrom interpolation the same way as for float values
                     if (i < 7) {
-                        volk_32fc_32f_dot_prod_32fc((lv_32fc_t*)&_p_0T, (lv_32fc_t*)&delay[i], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8);
+                        fir_kernels::dot(&_p_0T, (const complex_t*)&delay[i], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8, 1);
                     }
                     else {
-                        volk_32fc_32f_dot_prod_32fc((lv_32fc_t*)&_p_0T, (lv_32fc_t*)&_in->readBuf[i - 7], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8);
+                        fir_kernels::dot(&_p_0T, (const complex_t*)&in[i - 7], INTERP_TAPS[(int)roundf(_mu * 128.0f)], 8, 1);
                     }
-                    out.writeBuf[outCount++] = _p_0T;
+                    out[outCount++] = _p_0T;
 
                     // Slice output value
                     _c_0T = DSP_STEP_CPLX(_p_0T);
@@ -203,7 +204,43 @@ namespace dsp {
             nextOffset = i - count;
 
             // Save the last 7 values for the next round
-            memcpy(delay, &_in->readBuf[count - 7], 7 * sizeof(T));
+            memcpy(delay, &in[count - 7], 7 * sizeof(T));
+
+            return outCount;
+        }
+
+        int run() {
+            count = _in->read();
+            if (count < 0) { return -1; }
+
+            int outCount;
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            if (tags.empty()) {
+                outCount = process(count, _in->readBuf, out.writeBuf);
+            }
+            else {
+                // Process up to each tag so that it lands on the first symbol taken at or after its item.
+                // The kernel needs at least 7 samples per call, tags closer than that share a symbol
+                // and those in the last 7 samples go on the last one.
+                uint64_t inOffset = _in->getReadOffset();
+                int done = 0;
+                outCount = 0;
+                tagSymbols.clear();
+                for (auto& tag : tags) {
+                    int split = std::clamp<int64_t>(tag.offset - inOffset, 0, count);
+                    if (split - done >= 7 && count - split >= 7) {
+                        outCount += process(split - done, &_in->readBuf[done], &out.writeBuf[outCount]);
+                        done = split;
+                    }
+                    tagSymbols.push_back((count - split >= 7) ? outCount : INT_MAX);
+                }
+                outCount += process(count - done, &_in->readBuf[done], &out.writeBuf[outCount]);
+
+                // Tags past the last symbol stay on it
+                for (size_t i = 0; i < tags.size() && outCount > 0; i++) {
+                    out.addTag(std::min<int>(tagSymbols[i], outCount - 1), tags[i].key, tags[i].value);
+                }
+            }
             
             _in->flush();
             if (!out.swap(outCount)) { return -1; }
@@ -213,10 +250,42 @@ namespace dsp {
         stream<T> out;
 
     private:
+        struct params {
+            float omega;
+            float omegaRelLimit;
+            float gainOmega;
+            float muGain;
+            int omegaSeq;       // Bumped by setOmega(), the tracked rate then restarts from the new one
+        };
+
+        void applyParams() {
+            params p;
+            if (!paramBox.fetch(p)) { return; }
+            _omega = p.omega;
+            _omegaRelLimit = p.omegaRelLimit;
+            _gainOmega = p.gainOmega;
+            _muGain = p.muGain;
+            omegaMin = _omega - (_omega * _omegaRelLimit);
+            omegaMax = _omega + (_omega * _omegaRelLimit);
+            if (p.omegaSeq != omegaSeq) {
+                omegaSeq = p.omegaSeq;
+                _dynOmega = _omega;
+            }
+            else {
+                _dynOmega = std::clamp<float>(_dynOmega, omegaMin, omegaMax);
+            }
+        }
+
         int count;
 
+        param_mailbox<params> paramBox;
+        int omegaSeq = 0;
+
+        // Output index of each input tag, kept to avoid reallocating
+        std::vector<int> tagSymbols;
+
         // Delay buffer
-        T delay[1024];
+        T delay[1024] = {};
         int nextOffset = 0;
 
         // Configuration
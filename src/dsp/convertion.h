@@ -12,6 +12,7 @@ namespace dsp {
 
         void init(stream<complex_t>* in) {
             _in = in;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<ComplexToStereo>::registerInput(_in);
             generic_block<ComplexToStereo>::registerOutput(&out);
         }
@@ -31,6 +32,7 @@ namespace dsp {
 
             memcpy(out.writeBuf, _in->readBuf, count * sizeof(complex_t));
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -51,6 +53,7 @@ namespace dsp {
 
         void init(stream<complex_t>* in) {
             _in = in;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<ComplexToReal>::registerInput(_in);
             generic_block<ComplexToReal>::registerOutput(&out);
         }
@@ -70,6 +73,7 @@ namespace dsp {
 
             volk_32fc_deinterleave_real_32f(out.writeBuf, (lv_32fc_t*)_in->readBuf, count);
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -90,6 +94,7 @@ namespace dsp {
 
         void init(stream<complex_t>* in) {
             _in = in;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<ComplexToImag>::registerInput(_in);
             generic_block<ComplexToImag>::registerOutput(&out);
         }
@@ -109,6 +114,7 @@ namespace dsp {
 
             volk_32fc_deinterleave_imag_32f(out.writeBuf, (lv_32fc_t*)_in->readBuf, count);
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if(!out.swap(count)) { return -1; }
             return count;
@@ -130,13 +136,13 @@ namespace dsp {
 
         ~RealToComplex() {
             generic_block<RealToComplex>::stop();
-            delete[] nullBuffer;
+            buffer::free(nullBuffer);
         }
 
         void init(stream<float>* in) {
             _in = in;
-            nullBuffer = new float[STREAM_BUFFER_SIZE];
-            memset(nullBuffer, 0, STREAM_BUFFER_SIZE * sizeof(float));
+            allocNullBuffer();
+            out.setBufferSize(_in->getBufferSize());
             generic_block<RealToComplex>::registerInput(_in);
             generic_block<RealToComplex>::registerOutput(&out);
         }
@@ -146,6 +152,8 @@ namespace dsp {
             generic_block<RealToComplex>::tempStop();
             generic_block<RealToComplex>::unregisterInput(_in);
             _in = in;
+            buffer::free(nullBuffer);
+            allocNullBuffer();
             generic_block<RealToComplex>::registerInput(_in);
             generic_block<RealToComplex>::tempStart();
         }
@@ -156,6 +164,7 @@ namespace dsp {
 
             volk_32f_x2_interleave_32fc((lv_32fc_t*)out.writeBuf, _in->readBuf, nullBuffer, count);
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -164,8 +173,153 @@ namespace dsp {
         stream<complex_t> out;
 
     private:
+        void allocNullBuffer() {
+            nullBuffer = buffer::alloc<float>(_in->getBufferSize());
+            memset(nullBuffer, 0, _in->getBufferSize() * sizeof(float));
+        }
+
         float* nullBuffer;
         stream<float>* _in;
 
     };
+
+    // complex_int16 or complex_int8 IQ to complex_t, full scale becomes 1.0
+    template <class T>
+    class FixedToComplex : public generic_block<FixedToComplex<T>> {
+        static_assert(std::is_same_v<T, complex_int16> || std::is_same_v<T, complex_int8>, "FixedToComplex needs complex_int16 or complex_int8 data");
+    public:
+        FixedToComplex() {}
+
+        FixedToComplex(stream<T>* in) { init(in); }
+
+        void init(stream<T>* in) {
+            _in = in;
+            out.setBufferSize(_in->getBufferSize());
+            generic_block<FixedToComplex<T>>::registerInput(_in);
+            generic_block<FixedToComplex<T>>::registerOutput(&out);
+        }
+
+        void setInput(stream<T>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<FixedToComplex<T>>::ctrlMtx);
+            generic_block<FixedToComplex<T>>::tempStop();
+            generic_block<FixedToComplex<T>>::unregisterInput(_in);
+            _in = in;
+            generic_block<FixedToComplex<T>>::registerInput(_in);
+            generic_block<FixedToComplex<T>>::tempStart();
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            if constexpr (std::is_same_v<T, complex_int16>) {
+                volk_16i_s32f_convert_32f((float*)out.writeBuf, (const int16_t*)_in->readBuf, 32768.0f, count * 2);
+            }
+            else {
+                volk_8i_s32f_convert_32f((float*)out.writeBuf, (const int8_t*)_in->readBuf, 128.0f, count * 2);
+            }
+
+            forwardTags(_in, &out, count);
+            _in->flush();
+            if (!out.swap(count)) { return -1; }
+            return count;
+        }
+
+        stream<complex_t> out;
+
+    private:
+        stream<T>* _in;
+
+    };
+
+    // complex_t to complex_int16 or complex_int8 IQ, saturating past full scale
+    template <class T>
+    class ComplexToFixed : public generic_block<ComplexToFixed<T>> {
+        static_assert(std::is_same_v<T, complex_int16> || std::is_same_v<T, complex_int8>, "ComplexToFixed needs complex_int16 or complex_int8 data");
+    public:
+        ComplexToFixed() {}
+
+        ComplexToFixed(stream<complex_t>* in) { init(in); }
+
+        void init(stream<complex_t>* in) {
+            _in = in;
+            out.setBufferSize(_in->getBufferSize());
+            generic_block<ComplexToFixed<T>>::registerInput(_in);
+            generic_block<ComplexToFixed<T>>::registerOutput(&out);
+        }
+
+        void setInput(stream<complex_t>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<ComplexToFixed<T>>::ctrlMtx);
+            generic_block<ComplexToFixed<T>>::tempStop();
+            generic_block<ComplexToFixed<T>>::unregisterInput(_in);
+            _in = in;
+            generic_block<ComplexToFixed<T>>::registerInput(_in);
+            generic_block<ComplexToFixed<T>>::tempStart();
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            if constexpr (std::is_same_v<T, complex_int16>) {
+                volk_32f_s32f_convert_16i((int16_t*)out.writeBuf, (const float*)_in->readBuf, 32768.0f, count * 2);
+            }
+            else {
+                volk_32f_s32f_convert_8i((int8_t*)out.writeBuf, (const float*)_in->readBuf, 128.0f, count * 2);
+            }
+
+            forwardTags(_in, &out, count);
+            _in->flush();
+            if (!out.swap(count)) { return -1; }
+            return count;
+        }
+
+        stream<T> out;
+
+    private:
+        stream<complex_t>* _in;
+
+    };
+
+    // Widens complex_int8 IQ for the fixed point blocks, which all work on complex_int16
+    class ComplexInt8ToInt16 : public generic_block<ComplexInt8ToInt16> {
+    public:
+        ComplexInt8ToInt16() {}
+
+        ComplexInt8ToInt16(stream<complex_int8>* in) { init(in); }
+
+        void init(stream<complex_int8>* in) {
+            _in = in;
+            out.setBufferSize(_in->getBufferSize());
+            generic_block<ComplexInt8ToInt16>::registerInput(_in);
+            generic_block<ComplexInt8ToInt16>::registerOutput(&out);
+        }
+
+        void setInput(stream<complex_int8>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<ComplexInt8ToInt16>::ctrlMtx);
+            generic_block<ComplexInt8ToInt16>::tempStop();
+            generic_block<ComplexInt8ToInt16>::unregisterInput(_in);
+            _in = in;
+            generic_block<ComplexInt8ToInt16>::registerInput(_in);
+            generic_block<ComplexInt8ToInt16>::tempStart();
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            volk_8i_convert_16i((int16_t*)out.writeBuf, (const int8_t*)_in->readBuf, count * 2);
+
+            forwardTags(_in, &out, count);
+            _in->flush();
+            if (!out.swap(count)) { return -1; }
+            return count;
+        }
+
+        stream<complex_int16> out;
+
+    private:
+        stream<complex_int8>* _in;
+
+    };
 }
\ No newline at end of file
@@ -14,16 +14,18 @@ namespace dsp {
 
         ~Deframer() {
             generic_block<Deframer>::stop();
+            buffer::free(buffer);
+            buffer::free(_syncword);
         }
 
         void init(stream<uint8_t>* in, int frameLen, uint8_t* syncWord, int syncLen) {
             _in = in;
             _frameLen = frameLen;
-            _syncword = new  uint8_t[syncLen];
+            _syncword = buffer::alloc<uint8_t>(syncLen);
             _syncLen = syncLen;
             memcpy(_syncword, syncWord, syncLen);
 
-            buffer = new uint8_t[STREAM_BUFFER_SIZE + syncLen];
+            buffer = buffer::alloc<uint8_t>(_in->getBufferSize() + syncLen);
             memset(buffer, 0, syncLen);
             bufferStart = buffer + syncLen;
             
@@ -39,8 +41,24 @@ namespace dsp {
             // Copy data into work buffer
             memcpy(bufferStart, _in->readBuf, count - 1);
 
+            // buffer[i] holds the item at absolute offset inOffset + i - _syncLen
+            uint64_t inOffset = _in->getReadOffset();
+            const std::vector<stream_tag>& newTags = _in->getReadTags();
+            inTags.insert(inTags.end(), newTags.begin(), newTags.end());
+            size_t nextTag = 0;
+
             // Iterate through all symbols
             for (int i = 0; i < count;) {
+                // Tags go to the byte their bit ends up in, or to the start of the next frame
+                while (nextTag < inTags.size() && inTags[nextTag].offset + _syncLen <= inOffset + i) {
+                    if (bitsRead >= 0) {
+                        out.addTag(bitsRead / 8, inTags[nextTag].key, inTags[nextTag].value);
+                    }
+                    else {
+                        holdTag(inTags[nextTag]);
+                    }
+                    nextTag++;
+                }
 
                 // If already in the process of reading bits 
                 if (bitsRead >= 0) {
@@ -62,6 +80,7 @@ namespace dsp {
                 else if (memcmp(buffer + i, _syncword, _syncLen) == 0) {
                     bitsRead = 0;
                     badFrameCount = 0;
+                    startFrameTags();
                     continue;
                 }
                 else if (nextBitIsStartOfFrame) {
@@ -71,6 +90,7 @@ namespace dsp {
                     if (badFrameCount < 5) {
                         badFrameCount++;
                         bitsRead = 0;
+                        startFrameTags();
                         continue;
                     }
 
@@ -84,6 +104,9 @@ namespace dsp {
 
             // Keep last _syncLen4 symbols
             memcpy(buffer, &_in->readBuf[count - _syncLen], _syncLen);
+
+            // Tags of the kept symbols are handled on the next run
+            inTags.erase(inTags.begin(), inTags.begin() + nextTag);
             
             //printf("Block processed\n");
             callcount++;
@@ -95,6 +118,24 @@ namespace dsp {
         stream<uint8_t> out;
 
     private:
+        // Keep only the latest tag of each key until a frame starts
+        void holdTag(const stream_tag& tag) {
+            for (auto& held : frameTags) {
+                if (held.key == tag.key) {
+                    held = tag;
+                    return;
+                }
+            }
+            frameTags.push_back(tag);
+        }
+
+        void startFrameTags() {
+            for (auto& tag : frameTags) {
+                out.addTag(0, tag.key, tag.value);
+            }
+            frameTags.clear();
+        }
+
         uint8_t* buffer;
         uint8_t* bufferStart;
         uint8_t* _syncword;
@@ -107,6 +148,9 @@ namespace dsp {
         bool nextBitIsStartOfFrame = false;
 
         int callcount = 0;
+
+        std::vector<stream_tag> inTags;
+        std::vector<stream_tag> frameTags;
         
         stream<uint8_t>* _in;
 
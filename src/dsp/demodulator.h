@@ -7,6 +7,7 @@
 #include <spdlog/spdlog.h>
 #include <dsp/pll.h>
 #include <dsp/clock_recovery.h>
+#include <dsp/fused.h>
 
 #define FAST_ATAN2_COEF1    FL_M_PI / 4.0f
 #define FAST_ATAN2_COEF2    3.0f * FAST_ATAN2_COEF1
@@ -41,6 +42,7 @@ namespace dsp {
             _sampleRate = sampleRate;
             _deviation = deviation;
             phasorSpeed = (2 * FL_M_PI) / (_sampleRate / _deviation);
+            out.setBufferSize(_in->getBufferSize());
             generic_block<FloatFMDemod>::registerInput(_in);
             generic_block<FloatFMDemod>::registerOutput(&out);
         }
@@ -93,6 +95,7 @@ namespace dsp {
                 phase = currentPhase;
             }
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -118,6 +121,7 @@ namespace dsp {
             _sampleRate = sampleRate;
             _deviation = deviation;
             phasorSpeed = (2 * FL_M_PI) / (_sampleRate / _deviation);
+            out.setBufferSize(_in->getBufferSize());
             generic_block<FMDemod>::registerInput(_in);
             generic_block<FMDemod>::registerOutput(&out);
         }
@@ -172,6 +176,7 @@ namespace dsp {
                 phase = currentPhase;
             }
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -194,24 +199,22 @@ namespace dsp {
 
         ~StereoFMDemod() {
             generic_block<StereoFMDemod>::stop();
-            delete[] doubledPilot;
-            delete[] a_minus_b;
-            delete[] a_out;
-            delete[] b_out;
+            freeBuffers();
         }
 
         void init(stream<complex_t>* in, float sampleRate, float deviation) {
             _sampleRate = sampleRate;
 
-            doubledPilot = new float[STREAM_BUFFER_SIZE];
-            a_minus_b = new float[STREAM_BUFFER_SIZE];
-            a_out = new float[STREAM_BUFFER_SIZE];
-            b_out = new float[STREAM_BUFFER_SIZE];
+            allocBuffers(in->getBufferSize());
+            filterInput.setBufferSize(in->getBufferSize());
+            decodeInput.setBufferSize(in->getBufferSize());
+            out.setBufferSize(in->getBufferSize());
 
             fmDemod.init(in, sampleRate, deviation);
             split.init(&fmDemod.out);
             split.bindStream(&filterInput);
             split.bindStream(&decodeInput);
+            split.setZeroCopy(true);
 
             // Filter init
             win.init(1000, 1000, 19000, sampleRate);
@@ -226,6 +229,8 @@ namespace dsp {
             std::lock_guard<std::mutex> lck(generic_block<StereoFMDemod>::ctrlMtx);
             generic_block<StereoFMDemod>::tempStop();
             fmDemod.setInput(in);
+            freeBuffers();
+            allocBuffers(in->getBufferSize());
             generic_block<StereoFMDemod>::tempStart();
         }
 
@@ -267,6 +272,7 @@ namespace dsp {
             volk_32f_x2_add_32f(a_out, decodeInput.readBuf, a_minus_b, count);
             volk_32f_x2_subtract_32f(b_out, decodeInput.readBuf, a_minus_b, count);
 
+            forwardTags(&decodeInput, &out, count);
             decodeInput.flush();
             agc.out.flush();
 
@@ -282,6 +288,7 @@ namespace dsp {
                 return;
             }
             generic_block<StereoFMDemod>::running = true;
+            generic_block<StereoFMDemod>::beginRun();
             generic_block<StereoFMDemod>::doStart();
             fmDemod.start();
             split.start();
@@ -298,13 +305,29 @@ namespace dsp {
             split.stop();
             filter.stop();
             agc.stop();
+            generic_block<StereoFMDemod>::stopping = true;
             generic_block<StereoFMDemod>::doStop();
+            generic_block<StereoFMDemod>::endRun();
             generic_block<StereoFMDemod>::running = false;
         }
 
         stream<stereo_t> out;
 
     private:
+        void allocBuffers(int size) {
+            doubledPilot = buffer::alloc<float>(size);
+            a_minus_b = buffer::alloc<float>(size);
+            a_out = buffer::alloc<float>(size);
+            b_out = buffer::alloc<float>(size);
+        }
+
+        void freeBuffers() {
+            buffer::free(doubledPilot);
+            buffer::free(a_minus_b);
+            buffer::free(a_out);
+            buffer::free(b_out);
+        }
+
         int count;
         int countFilter;
 
@@ -337,6 +360,7 @@ namespace dsp {
 
         void init(stream<complex_t>* in) {
             _in = in;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<AMDemod>::registerInput(_in);
             generic_block<AMDemod>::registerOutput(&out);
         }
@@ -356,6 +380,7 @@ namespace dsp {
 
             volk_32fc_magnitude_32f(out.writeBuf, (lv_32fc_t*)_in->readBuf, count);
 
+            forwardTags(_in, &out, count);
             _in->flush();
 
             float avg;
@@ -385,7 +410,7 @@ namespace dsp {
 
         ~SSBDemod() {
             generic_block<SSBDemod>::stop();
-            delete[] buffer;
+            buffer::free(buffer);
         }
 
         enum {
@@ -411,7 +436,8 @@ namespace dsp {
                 phaseDelta = lv_cmake(1.0f, 0.0f);
                 break;
             }
-            buffer = new lv_32fc_t[STREAM_BUFFER_SIZE];
+            buffer = buffer::alloc<lv_32fc_t>(_in->getBufferSize());
+            out.setBufferSize(_in->getBufferSize());
             generic_block<SSBDemod>::registerInput(_in);
             generic_block<SSBDemod>::registerOutput(&out);
         }
@@ -421,6 +447,8 @@ namespace dsp {
             generic_block<SSBDemod>::tempStop();
             generic_block<SSBDemod>::unregisterInput(_in);
             _in = in;
+            buffer::free(buffer);
+            buffer = buffer::alloc<lv_32fc_t>(_in->getBufferSize());
             generic_block<SSBDemod>::registerInput(_in);
             generic_block<SSBDemod>::tempStart();
         }
@@ -479,6 +507,7 @@ namespace dsp {
             volk_32fc_s32fc_x2_rotator_32fc(buffer, (lv_32fc_t*)_in->readBuf, phaseDelta, &phase, count);
             volk_32fc_deinterleave_real_32f(out.writeBuf, buffer, count);
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -587,51 +616,45 @@ namespace dsp {
             rrc.init(&agc.out, &taps);
             demod.init(&rrc.out, _costasLoopBw);
 
-            generic_hier_block<PSKDemod<ORDER, OFFSET>>::registerBlock(&agc);
-            generic_hier_block<PSKDemod<ORDER, OFFSET>>::registerBlock(&rrc);
-            generic_hier_block<PSKDemod<ORDER, OFFSET>>::registerBlock(&demod);
-
+            // The whole chain runs in a single thread, the blocks only provide their kernels
             if constexpr (OFFSET) {
                 delay.init(&demod.out);
                 recov.init(&delay.out, _sampleRate / _baudRate, _omegaGain, _muGain, _omegaRelLimit);
-                generic_hier_block<PSKDemod<ORDER, OFFSET>>::registerBlock(&delay);
+                chain.init(input, &agc, &rrc, &demod, &delay, &recov);
             }   
             else {
                 recov.init(&demod.out, _sampleRate / _baudRate, _omegaGain, _muGain, _omegaRelLimit);
+                chain.init(input, &agc, &rrc, &demod, &recov);
             }
 
-            generic_hier_block<PSKDemod<ORDER, OFFSET>>::registerBlock(&recov);
+            generic_hier_block<PSKDemod<ORDER, OFFSET>>::registerBlock(&chain);
 
-            out = &recov.out;
+            out = &chain.out;
         }
 
         void setInput(stream<complex_t>* input) {
-            agc.setInput(input);
+            chain.setInput(input);
         }
 
+        // None of the setters stop the chain, the RRC taps and loop parameters are swapped between buffers
         void setSampleRate(float sampleRate) {
+            std::lock_guard<std::mutex> lck(generic_hier_block<PSKDemod<ORDER, OFFSET>>::ctrlMtx);
             _sampleRate = sampleRate;
-            rrc.tempStop();
-            recov.tempStop();
             taps.setSampleRate(_sampleRate);
             rrc.updateWindow(&taps);
             recov.setOmega(_sampleRate / _baudRate, _omegaRelLimit);
-            rrc.tempStart();
-            recov.tempStart();
         }
 
         void setBaudRate(float baudRate) {
+            std::lock_guard<std::mutex> lck(generic_hier_block<PSKDemod<ORDER, OFFSET>>::ctrlMtx);
             _baudRate = baudRate;
-            rrc.tempStop();
-            recov.tempStop();
             taps.setBaudRate(_baudRate);
             rrc.updateWindow(&taps);
             recov.setOmega(_sampleRate / _baudRate, _omegaRelLimit);
-            rrc.tempStart();
-            recov.tempStart();
         }
 
         void setRRCParams(int RRCTapCount, float RRCAlpha) {
+            std::lock_guard<std::mutex> lck(generic_hier_block<PSKDemod<ORDER, OFFSET>>::ctrlMtx);
             _RRCTapCount = RRCTapCount;
             _RRCAlpha = RRCAlpha;
             taps.setTapCount(_RRCTapCount);
@@ -640,22 +663,26 @@ namespace dsp {
         }
 
         void setAgcRate(float agcRate) {
+            std::lock_guard<std::mutex> lck(generic_hier_block<PSKDemod<ORDER, OFFSET>>::ctrlMtx);
             _agcRate = agcRate;
             agc.setRate(_agcRate);
         }
 
         void setCostasLoopBw(float costasLoopBw) {
+            std::lock_guard<std::mutex> lck(generic_hier_block<PSKDemod<ORDER, OFFSET>>::ctrlMtx);
             _costasLoopBw = costasLoopBw;
             demod.setLoopBandwidth(_costasLoopBw);
         }
 
         void setMMGains(float omegaGain, float myGain) {
+            std::lock_guard<std::mutex> lck(generic_hier_block<PSKDemod<ORDER, OFFSET>>::ctrlMtx);
             _omegaGain = omegaGain;
             _muGain = myGain;
             recov.setGains(_omegaGain, _muGain);
         }
 
         void setOmegaRelLimit(float omegaRelLimit) {
+            std::lock_guard<std::mutex> lck(generic_hier_block<PSKDemod<ORDER, OFFSET>>::ctrlMtx);
             _omegaRelLimit = omegaRelLimit;
             recov.setOmegaRelLimit(_omegaRelLimit);
         }
@@ -669,6 +696,9 @@ namespace dsp {
         CostasLoop<ORDER> demod;
         DelayImag delay;
         MMClockRecovery<dsp::complex_t> recov;
+        std::conditional_t<OFFSET,
+            fused<ComplexAGC, FIR<complex_t>, CostasLoop<ORDER>, DelayImag, MMClockRecovery<complex_t>>,
+            fused<ComplexAGC, FIR<complex_t>, CostasLoop<ORDER>, MMClockRecovery<complex_t>>> chain;
 
         int _RRCTapCount;
         float _RRCAlpha;
@@ -1,12 +1,20 @@
 #pragma once
 #include <dsp/block.h>
 #include <dsp/window.h>
+#include <dsp/utils/fft_plans.h>
+#include <dsp/utils/iir_kernels.h>
+#include <cmath>
 #include <string.h>
 
+// Tap count from which FFTFIR switches from the direct form to fast convolution
+#define FFTFIR_MIN_TAPS     64
+
 namespace dsp {
 
+    // complex_int16 data is filtered in fixed point, with the taps quantized to 16 bits
     template <class T>
     class FIR : public generic_block<FIR<T>> {
+        using set_type = std::conditional_t<std::is_same_v<T, complex_int16>, fixed_tap_set, tap_set>;
     public:
         FIR() {}
 
@@ -14,19 +22,21 @@ namespace dsp {
 
         ~FIR() {
             generic_block<FIR<T>>::stop();
-            volk_free(buffer);
-            volk_free(taps);
+            buffer::free(buffer);
         }
 
         void init(stream<T>* in, dsp::filter_window::generic_window* window) {
             _in = in;
+            _window = window;
 
-            tapCount = window->getTapCount();
-            taps = (float*)volk_malloc(tapCount * sizeof(float), volk_get_alignment());
-            window->createTaps(taps, tapCount);
+            tapBox.reset(new set_type(window));
+            taps = tapBox.get()->taps;
+            tapCount = tapBox.get()->count;
+            symmetric = tapBox.get()->symmetric;
+            if constexpr (std::is_same_v<T, complex_int16>) { shift = tapBox.get()->shift; }
 
-            buffer = (T*)volk_malloc(STREAM_BUFFER_SIZE * sizeof(T) * 2, volk_get_alignment());
-            bufStart = &buffer[tapCount];
+            allocBuffer();
+            out.setBufferSize(_in->getBufferSize());
             generic_block<FIR<T>>::registerInput(_in);
             generic_block<FIR<T>>::registerOutput(&out);
         }
@@ -36,139 +46,435 @@ namespace dsp {
             generic_block<FIR<T>>::tempStop();
             generic_block<FIR<T>>::unregisterInput(_in);
             _in = in;
+            buffer::free(buffer);
+            allocBuffer();
             generic_block<FIR<T>>::registerInput(_in);
             generic_block<FIR<T>>::tempStart();
         }
 
+        // The new taps are designed right away and used from the next buffer on, the block keeps running
         void updateWindow(dsp::filter_window::generic_window* window) {
+            std::lock_guard<std::mutex> lck(generic_block<FIR<T>>::ctrlMtx);
             _window = window;
-            volk_free(taps);
-            tapCount = window->getTapCount();
-            taps = (float*)volk_malloc(tapCount * sizeof(float), volk_get_alignment());
-            window->createTaps(taps, tapCount);
+            tapBox.post(new set_type(window));
+        }
+
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        // count must not exceed the input stream's buffer size.
+        int process(int count, const T* in, T* out) {
+            if (tapBox.update()) { applyTaps(); }
+
+            memcpy(bufStart, in, count * sizeof(T));
+
+            if constexpr (std::is_same_v<T, complex_int16>) {
+                fir_kernels::dotFixed(out, &buffer[1], taps, tapCount, shift, count);
+            }
+            else {
+                fir_kernels::filter(out, &buffer[1], taps, tapCount, symmetric, count);
+            }
+
+            memmove(buffer, &buffer[count], tapCount * sizeof(T));
+
+            return count;
         }
 
         int run() {
             int count = _in->read();
             if (count < 0) { return -1; }
 
-            memcpy(bufStart, _in->readBuf, count * sizeof(T));
+            process(count, _in->readBuf, out.writeBuf);
+            forwardTags(_in, &out, count);
             _in->flush();
 
-            if constexpr (std::is_same_v<T, float>) {
-                for (int i = 0; i < count; i++) {
-                    volk_32f_x2_dot_prod_32f((float*)&out.writeBuf[i], (float*)&buffer[i+1], taps, tapCount);
-                }
+            if (!out.swap(count)) { return -1; }
+            return count;
+        }
+
+        stream<T> out;
+
+    private:
+        // Work buffer holds the filter history followed by one input buffer
+        void allocBuffer() {
+            int size = _in->getBufferSize() + tapCount;
+            buffer = buffer::alloc<T>(size);
+            memset(buffer, 0, size * sizeof(T));
+            bufStart = &buffer[tapCount];
+            bufTapCount = tapCount;
+        }
+
+        // Switch to the taps posted by updateWindow(), keeping the part of the history the new filter still needs
+        void applyTaps() {
+            int oldCount = tapCount;
+            taps = tapBox.get()->taps;
+            tapCount = tapBox.get()->count;
+            symmetric = tapBox.get()->symmetric;
+            if constexpr (std::is_same_v<T, complex_int16>) { shift = tapBox.get()->shift; }
+
+            if (tapCount > bufTapCount) {
+                T* old = buffer;
+                allocBuffer();
+                memcpy(&buffer[tapCount - oldCount], old, oldCount * sizeof(T));
+                buffer::free(old);
             }
-            if constexpr (std::is_same_v<T, complex_t>) {
-                for (int i = 0; i < count; i++) {
-                    volk_32fc_32f_dot_prod_32fc((lv_32fc_t*)&out.writeBuf[i], (lv_32fc_t*)&buffer[i+1], taps, tapCount);
-                }
+            else if (tapCount > oldCount) {
+                memmove(&buffer[tapCount - oldCount], buffer, oldCount * sizeof(T));
+                memset(buffer, 0, (tapCount - oldCount) * sizeof(T));
+            }
+            else if (tapCount < oldCount) {
+                memmove(buffer, &buffer[oldCount - tapCount], tapCount * sizeof(T));
             }
+            bufStart = &buffer[tapCount];
+        }
 
-            if (!out.swap(count)) { return -1; }
+        stream<T>* _in;
+
+        dsp::filter_window::generic_window* _window;
+
+        T* bufStart;
+        T* buffer;
+        int bufTapCount;
+
+        // Copies of the active set's, read on every sample
+        int tapCount;
+        decltype(set_type::taps) taps;
+        bool symmetric;
+        int shift;          // Fixed point only
+        ptr_mailbox<set_type> tapBox;
+
+    };
+
+    // Same filter as FIR, computed by overlap-save fast convolution once the taps are long
+    // enough for it to pay off. Each FFT of size N = pow2 >= 4 * taps outputs N - taps + 1
+    // samples, shorter buffers just use a partial block, so there is no added latency and
+    // the output matches FIR's within float rounding.
+    template <class T>
+    class FFTFIR : public generic_block<FFTFIR<T>> {
+    public:
+        FFTFIR() {}
+
+        FFTFIR(stream<T>* in, dsp::filter_window::generic_window* window) { init(in, window); }
+
+        ~FFTFIR() {
+            generic_block<FFTFIR<T>>::stop();
+            buffer::free(buffer);
+        }
+
+        void init(stream<T>* in, dsp::filter_window::generic_window* window) {
+            _in = in;
+            _window = window;
+
+            tapBox.reset(new fft_tap_set(window));
+            set = tapBox.get();
+            tapCount = set->count;
+
+            allocBuffer();
+            out.setBufferSize(_in->getBufferSize());
+            generic_block<FFTFIR<T>>::registerInput(_in);
+            generic_block<FFTFIR<T>>::registerOutput(&out);
+        }
+
+        void setInput(stream<T>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<FFTFIR<T>>::ctrlMtx);
+            generic_block<FFTFIR<T>>::tempStop();
+            generic_block<FFTFIR<T>>::unregisterInput(_in);
+            _in = in;
+            buffer::free(buffer);
+            allocBuffer();
+            generic_block<FFTFIR<T>>::registerInput(_in);
+            generic_block<FFTFIR<T>>::tempStart();
+        }
+
+        // Taps and their spectrum are computed right away and used from the next buffer on
+        void updateWindow(dsp::filter_window::generic_window* window) {
+            std::lock_guard<std::mutex> lck(generic_block<FFTFIR<T>>::ctrlMtx);
+            _window = window;
+            tapBox.post(new fft_tap_set(window));
+        }
+
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        // count must not exceed the input stream's buffer size.
+        int process(int count, const T* in, T* out) {
+            if (tapBox.update()) { applyTaps(); }
+
+            memcpy(bufStart, in, count * sizeof(T));
+
+            if (!set->fftSize) {
+                fir_kernels::filter(out, &buffer[1], set->taps, tapCount, set->symmetric, count);
+            }
+            else {
+                // Outputs past tapCount - 1 only depend on the samples copied in, no need to clear the rest
+                for (int i = 0; i < count; i += set->blockSize) {
+                    int len = std::min<int>(set->blockSize, count - i);
+                    memcpy(set->time, &buffer[i+1], (tapCount - 1 + len) * sizeof(T));
+                    set->convolve();
+                    memcpy(&out[i], &set->time[tapCount - 1], len * sizeof(T));
+                }
+            }
 
             memmove(buffer, &buffer[count], tapCount * sizeof(T));
 
             return count;
         }
 
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            process(count, _in->readBuf, out.writeBuf);
+            forwardTags(_in, &out, count);
+            _in->flush();
+
+            if (!out.swap(count)) { return -1; }
+            return count;
+        }
+
         stream<T> out;
 
     private:
+        // Taps plus, above FFTFIR_MIN_TAPS, their spectrum and the work arrays of the FFT form
+        struct fft_tap_set : public tap_set {
+            fft_tap_set(filter_window::generic_window* window) : tap_set(window) {
+                if (count < FFTFIR_MIN_TAPS) { return; }
+
+                fftSize = 1;
+                while (fftSize < 4 * count) { fftSize <<= 1; }
+                blockSize = fftSize - count + 1;
+                bins = std::is_same_v<T, float> ? ((fftSize / 2) + 1) : fftSize;
+
+                time = (T*)fftwf_malloc(fftSize * sizeof(T));
+                freq = fftwf_alloc_complex(bins);
+                spectrum = fftwf_alloc_complex(bins);
+                if constexpr (std::is_same_v<T, float>) {
+                    forward = fft_plans::get(FFT_R2C, fftSize);
+                    backward = fft_plans::get(FFT_C2R, fftSize);
+                }
+                else {
+                    forward = fft_plans::get(FFT_C2C_FORWARD, fftSize);
+                    backward = fft_plans::get(FFT_C2C_BACKWARD, fftSize);
+                }
+
+                // Reversed to turn FIR's dot product into a convolution, scaled to undo fftw's unnormalized inverse
+                memset(time, 0, fftSize * sizeof(T));
+                for (int i = 0; i < count; i++) {
+                    if constexpr (std::is_same_v<T, float>) {
+                        time[i] = taps[count - 1 - i] / (float)fftSize;
+                    }
+                    else {
+                        time[i] = { taps[count - 1 - i] / (float)fftSize, 0.0f };
+                    }
+                }
+                convolve(spectrum);
+            }
+
+            ~fft_tap_set() {
+                if (!fftSize) { return; }
+                fftwf_free(time);
+                fftwf_free(freq);
+                fftwf_free(spectrum);
+            }
+
+            // time = IFFT(FFT(time) * spectrum), or just the spectrum of time into dst
+            void convolve(fftwf_complex* dst = NULL) {
+                fftwf_complex* f = dst ? dst : freq;
+                if constexpr (std::is_same_v<T, float>) {
+                    fftwf_execute_dft_r2c(forward, (float*)time, f);
+                }
+                else {
+                    fftwf_execute_dft(forward, (fftwf_complex*)time, f);
+                }
+                if (dst) { return; }
+
+                volk_32fc_x2_multiply_32fc((lv_32fc_t*)freq, (lv_32fc_t*)freq, (lv_32fc_t*)spectrum, bins);
+
+                if constexpr (std::is_same_v<T, float>) {
+                    fftwf_execute_dft_c2r(backward, freq, (float*)time);
+                }
+                else {
+                    fftwf_execute_dft(backward, freq, (fftwf_complex*)time);
+                }
+            }
+
+            int fftSize = 0;        // 0 when using the direct form
+            int blockSize;          // New samples per FFT
+            int bins;
+            T* time;
+            fftwf_complex* freq;
+            fftwf_complex* spectrum;
+            fftwf_plan forward;
+            fftwf_plan backward;
+        };
+
+        // Work buffer holds the filter history followed by one input buffer
+        void allocBuffer() {
+            int size = _in->getBufferSize() + tapCount;
+            buffer = buffer::alloc<T>(size);
+            memset(buffer, 0, size * sizeof(T));
+            bufStart = &buffer[tapCount];
+            bufTapCount = tapCount;
+        }
+
+        // Same as FIR::applyTaps(), the history doesn't depend on the form
+        void applyTaps() {
+            int oldCount = tapCount;
+            set = tapBox.get();
+            tapCount = set->count;
+
+            if (tapCount > bufTapCount) {
+                T* old = buffer;
+                allocBuffer();
+                memcpy(&buffer[tapCount - oldCount], old, oldCount * sizeof(T));
+                buffer::free(old);
+            }
+            else if (tapCount > oldCount) {
+                memmove(&buffer[tapCount - oldCount], buffer, oldCount * sizeof(T));
+                memset(buffer, 0, (tapCount - oldCount) * sizeof(T));
+            }
+            else if (tapCount < oldCount) {
+                memmove(buffer, &buffer[oldCount - tapCount], tapCount * sizeof(T));
+            }
+            bufStart = &buffer[tapCount];
+        }
+
         stream<T>* _in;
 
         dsp::filter_window::generic_window* _window;
 
         T* bufStart;
         T* buffer;
+        int bufTapCount;
+
         int tapCount;
-        float* taps;
+        fft_tap_set* set;
+        ptr_mailbox<fft_tap_set> tapBox;
 
     };
 
-    class BFMDeemp : public generic_block<BFMDeemp> {
+    // Cascade of biquad sections for float, stereo_t and complex_t data, the same sections
+    // filtering every channel. The state carries over from one buffer to the next.
+    template <class T>
+    class IIR : public generic_block<IIR<T>> {
     public:
-        BFMDeemp() {}
+        IIR() {}
 
-        BFMDeemp(stream<stereo_t>* in, float sampleRate, float tau) { init(in, sampleRate, tau); }
+        IIR(stream<T>* in, const std::vector<biquad>& sections) { init(in, sections); }
 
-        ~BFMDeemp() { generic_block<BFMDeemp>::stop(); }
+        ~IIR() { generic_block<IIR<T>>::stop(); }
 
-        void init(stream<stereo_t>* in, float sampleRate, float tau) {
+        void init(stream<T>* in, const std::vector<biquad>& sections) {
             _in = in;
-            _sampleRate = sampleRate;
-            _tau = tau;
-            float dt = 1.0f / _sampleRate;
-            alpha = dt / (_tau + dt);
-            generic_block<BFMDeemp>::registerInput(_in);
-            generic_block<BFMDeemp>::registerOutput(&out);
+            sectionBox.reset(new section_set(sections));
+            state.swap(sectionBox.get()->state);
+            out.setBufferSize(_in->getBufferSize());
+            generic_block<IIR<T>>::registerInput(_in);
+            generic_block<IIR<T>>::registerOutput(&out);
         }
 
-        void setInput(stream<stereo_t>* in) {
-            std::lock_guard<std::mutex> lck(generic_block<BFMDeemp>::ctrlMtx);
-            generic_block<BFMDeemp>::tempStop();
-            generic_block<BFMDeemp>::unregisterInput(_in);
+        void setInput(stream<T>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<IIR<T>>::ctrlMtx);
+            generic_block<IIR<T>>::tempStop();
+            generic_block<IIR<T>>::unregisterInput(_in);
             _in = in;
-            generic_block<BFMDeemp>::registerInput(_in);
-            generic_block<BFMDeemp>::tempStart();
+            generic_block<IIR<T>>::registerInput(_in);
+            generic_block<IIR<T>>::tempStart();
         }
 
-        void setSampleRate(float sampleRate) {
-            _sampleRate = sampleRate;
-            float dt = 1.0f / _sampleRate;
-            alpha = dt / (_tau + dt);
-        }
-
-        void setTau(float tau) {
-            _tau = tau;
-            float dt = 1.0f / _sampleRate;
-            alpha = dt / (_tau + dt);
+        // Used from the next buffer on, the block keeps running. With the same number of
+        // sections the state is kept so that retuning doesn't click.
+        void setSections(const std::vector<biquad>& sections) {
+            std::lock_guard<std::mutex> lck(generic_block<IIR<T>>::ctrlMtx);
+            sectionBox.post(new section_set(sections));
         }
 
-        int run() {
-            count = _in->read();
-            if (count < 0) { return -1; }
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        int process(int count, const T* in, T* out) {
+            if (sectionBox.update()) { applySections(); }
+            section_set* set = sectionBox.get();
 
             if (bypass) {
-                memcpy(out.writeBuf, _in->readBuf, count * sizeof(stereo_t));
-                _in->flush();
-                if (!out.swap(count)) { return -1; }
+                if (out != in) { memcpy(out, in, count * sizeof(T)); }
                 return count;
             }
 
-            if (isnan(lastOutL)) {
-                lastOutL = 0.0f;
-            }
-            if (isnan(lastOutR)) {
-                lastOutR = 0.0f;
-            }
-            out.writeBuf[0].l = (alpha * _in->readBuf[0].l) + ((1-alpha) * lastOutL);
-            out.writeBuf[0].r = (alpha * _in->readBuf[0].r) + ((1-alpha) * lastOutR);
-            for (int i = 1; i < count; i++) {
-                out.writeBuf[i].l = (alpha * _in->readBuf[i].l) + ((1 - alpha) * out.writeBuf[i - 1].l);
-                out.writeBuf[i].r = (alpha * _in->readBuf[i].r) + ((1 - alpha) * out.writeBuf[i - 1].r);
+            iir_kernels::flush_denormals ftz;
+            iir_kernels::cascade(out, in, count, set->sections.data(), set->sections.size(), state.data());
+
+            // A NaN or inf input would otherwise poison every output after it
+            for (auto& s : state) {
+                if (!std::isfinite(s)) { s = 0.0f; }
             }
-            lastOutL = out.writeBuf[count - 1].l;
-            lastOutR = out.writeBuf[count - 1].r;
 
+            return count;
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            process(count, _in->readBuf, out.writeBuf);
+            forwardTags(_in, &out, count);
             _in->flush();
+
             if (!out.swap(count)) { return -1; }
             return count;
         }
 
+        // Passes the input through untouched
         bool bypass = false;
 
-        stream<stereo_t> out;
+        stream<T> out;
+
+    private:
+        static const int STATE_SIZE = 2 * (sizeof(T) / sizeof(float));
+
+        // Comes with a zeroed state so that the block never allocates while running
+        struct section_set {
+            section_set(const std::vector<biquad>& sections) : sections(sections), state(sections.size() * STATE_SIZE, 0.0f) {}
+
+            std::vector<biquad> sections;
+            std::vector<float> state;
+        };
+
+        // Keep the state if the set posted by setSections() has as many sections, else start from its zeroed one
+        void applySections() {
+            section_set* set = sectionBox.get();
+            if (set->state.size() != state.size()) {
+                state.swap(set->state);
+            }
+        }
+
+        stream<T>* _in;
+
+        std::vector<float> state;
+        ptr_mailbox<section_set> sectionBox;
+
+    };
+
+    // FM broadcast de-emphasis, a one pole low-pass with time constant tau on both channels
+    class BFMDeemp : public IIR<stereo_t> {
+    public:
+        BFMDeemp() {}
+
+        BFMDeemp(stream<stereo_t>* in, float sampleRate, float tau) { init(in, sampleRate, tau); }
+
+        void init(stream<stereo_t>* in, float sampleRate, float tau) {
+            _sampleRate = sampleRate;
+            _tau = tau;
+            IIR<stereo_t>::init(in, { biquad::onePoleLowpass(_sampleRate, _tau) });
+        }
+
+        void setSampleRate(float sampleRate) {
+            _sampleRate = sampleRate;
+            setSections({ biquad::onePoleLowpass(_sampleRate, _tau) });
+        }
+
+        void setTau(float tau) {
+            _tau = tau;
+            setSections({ biquad::onePoleLowpass(_sampleRate, _tau) });
+        }
 
     private:
-        int count;
-        float lastOutL = 0.0f;
-        float lastOutR = 0.0f;
-        float alpha;
         float _tau;
         float _sampleRate;
-        stream<stereo_t>* _in;
 
     };
-}
\ No newline at end of file
+}
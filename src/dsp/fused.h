@@ -0,0 +1,202 @@
+#pragma once
+#include <dsp/block.h>
+#include <tuple>
+#include <utility>
+#include <climits>
+
+// Number of input samples pushed through the whole chain at once, small enough for the
+// intermediate buffers to stay in cache
+#define FUSED_TILE_SIZE     4096
+
+// Fewest input samples the chain is run on when splitting a buffer at a tag, some kernels
+// (eg. MMClockRecovery's) need a few samples per call
+#define FUSED_MIN_SPLIT     64
+
+namespace dsp {
+    // Deduces a block's sample types from its process(int count, const IN* in, OUT* out) kernel
+    template <class F>
+    struct kernel_traits;
+
+    template <class B, class IN, class OUT>
+    struct kernel_traits<int (B::*)(int, const IN*, OUT*)> {
+        typedef IN in_type;
+        typedef OUT out_type;
+    };
+
+    // Runs the kernels of a linear chain of blocks back to back in a single thread, one cache
+    // sized tile at a time, instead of moving every sample through a stream between each of
+    // them. The blocks must be initialized as usual (their parameters and setters still apply)
+    // but must not be started themselves, only the fused block is.
+    //
+    // Example:
+    //     agc.init(&in, 1.0f, 65535, 10e-4);
+    //     rrc.init(&agc.out, &taps);
+    //     costas.init(&rrc.out, 0.004f);
+    //     fused<ComplexAGC, FIR<complex_t>, CostasLoop<4>> chain(&in, &agc, &rrc, &costas);
+    template <class... BLOCKS>
+    class fused : public generic_block<fused<BLOCKS...>> {
+        static_assert(sizeof...(BLOCKS) > 0, "At least one block is needed");
+
+        static constexpr int STAGES = sizeof...(BLOCKS);
+
+        template <int I>
+        using stage_block = std::tuple_element_t<I, std::tuple<BLOCKS...>>;
+
+        template <int I>
+        using stage_traits = kernel_traits<decltype(&stage_block<I>::process)>;
+
+    public:
+        typedef typename stage_traits<0>::in_type in_type;
+        typedef typename stage_traits<STAGES - 1>::out_type out_type;
+
+        fused() {}
+
+        fused(stream<in_type>* in, BLOCKS*... blocks) { init(in, blocks...); }
+
+        ~fused() {
+            generic_block<fused<BLOCKS...>>::stop();
+            freeScratch(std::make_index_sequence<STAGES - 1>());
+        }
+
+        void init(stream<in_type>* in, BLOCKS*... blocks) {
+            _in = in;
+            _blocks = std::make_tuple(blocks...);
+            allocScratch(std::make_index_sequence<STAGES - 1>());
+            out.setBufferSize(calcOutSize(_in->getBufferSize()));
+            generic_block<fused<BLOCKS...>>::registerInput(_in);
+            generic_block<fused<BLOCKS...>>::registerOutput(&out);
+        }
+
+        void setInput(stream<in_type>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<fused<BLOCKS...>>::ctrlMtx);
+            generic_block<fused<BLOCKS...>>::tempStop();
+            generic_block<fused<BLOCKS...>>::unregisterInput(_in);
+            _in = in;
+            generic_block<fused<BLOCKS...>>::registerInput(_in);
+            generic_block<fused<BLOCKS...>>::tempStart();
+        }
+
+        int calcOutSize(int inSize) {
+            return calcStageOutSize<STAGES - 1>(inSize);
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            // Like stream buffers, the work buffers go to the thread reading them
+            if (!scratchPlaced) {
+                placeScratch(std::make_index_sequence<STAGES - 1>());
+                scratchPlaced = true;
+            }
+
+            int outCount;
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            if (tags.empty()) {
+                outCount = processRange(0, count, 0);
+            }
+            else {
+                // The chain is run up to each tagged item so that its tag lands on the first output computed
+                // from that item on, whatever each stage does to the rate. Tags closer than FUSED_MIN_SPLIT
+                // samples to the previous split share it and those in the last ones go on the last output.
+                uint64_t inOffset = _in->getReadOffset();
+                int done = 0;
+                outCount = 0;
+                tagOutputs.clear();
+                for (auto& tag : tags) {
+                    int split = std::clamp<int64_t>(tag.offset - inOffset, 0, count);
+                    if (split - done >= FUSED_MIN_SPLIT && count - split >= FUSED_MIN_SPLIT) {
+                        outCount += processRange(done, split, outCount);
+                        done = split;
+                    }
+                    tagOutputs.push_back((count - split >= FUSED_MIN_SPLIT) ? outCount : INT_MAX);
+                }
+                outCount += processRange(done, count, outCount);
+
+                for (size_t i = 0; i < tags.size() && outCount > 0; i++) {
+                    out.addTag(std::min<int>(tagOutputs[i], outCount - 1), tags[i].key, tags[i].value);
+                }
+            }
+
+            _in->flush();
+            if (!out.swap(outCount)) { return -1; }
+            return count;
+        }
+
+        stream<out_type> out;
+
+    private:
+        // Runs input samples [begin, end) through the chain, writing from out.writeBuf[outPos] on. Split
+        // into equal tiles so that the last one isn't left with just a few samples. Returns the output count.
+        int processRange(int begin, int end, int outPos) {
+            int count = end - begin;
+            int tiles = (count + FUSED_TILE_SIZE - 1) / FUSED_TILE_SIZE;
+            int offset = 0;
+            int outCount = 0;
+            for (int i = 0; i < tiles; i++) {
+                int tileSize = (count - offset) / (tiles - i);
+                outCount += processStage<0>(tileSize, &_in->readBuf[begin + offset], &out.writeBuf[outPos + outCount]);
+                offset += tileSize;
+            }
+            return outCount;
+        }
+
+        template <int I>
+        int processStage(int count, const typename stage_traits<I>::in_type* in, out_type* dst) {
+            if constexpr (I < STAGES - 1) {
+                auto scratch = std::get<I>(_scratch);
+                int outCount = std::get<I>(_blocks)->process(count, in, scratch);
+                return processStage<I + 1>(outCount, scratch, dst);
+            }
+            else {
+                return std::get<I>(_blocks)->process(count, in, dst);
+            }
+        }
+
+        // One scratch buffer between each pair of stages, sized for a full tile
+        template <size_t... I>
+        void allocScratch(std::index_sequence<I...>) {
+            freeScratch(std::index_sequence<I...>());
+            ((std::get<I>(_scratch) = buffer::alloc<typename stage_traits<I>::out_type>(calcStageOutSize<I>(FUSED_TILE_SIZE))), ...);
+            scratchPlaced = false;
+        }
+
+        template <size_t... I>
+        void freeScratch(std::index_sequence<I...>) {
+            ((buffer::free(std::get<I>(_scratch)), std::get<I>(_scratch) = NULL), ...);
+        }
+
+        template <size_t... I>
+        void placeScratch(std::index_sequence<I...>) {
+            (buffer::readerStarted(std::get<I>(_scratch)), ...);
+        }
+
+        // Output size of stage I for inSize samples going into the chain
+        template <int I>
+        int calcStageOutSize(int inSize) {
+            if constexpr (I == 0) {
+                return std::get<0>(_blocks)->calcOutSize(inSize);
+            }
+            else {
+                return std::get<I>(_blocks)->calcOutSize(calcStageOutSize<I - 1>(inSize));
+            }
+        }
+
+        template <class SEQ>
+        struct scratch_tuple;
+
+        template <size_t... I>
+        struct scratch_tuple<std::index_sequence<I...>> {
+            typedef std::tuple<typename stage_traits<I>::out_type*...> type;
+        };
+
+        stream<in_type>* _in;
+        std::tuple<BLOCKS*...> _blocks;
+
+        // Output index of each input tag, kept to avoid reallocating
+        std::vector<int> tagOutputs;
+        typename scratch_tuple<std::make_index_sequence<STAGES - 1>>::type _scratch;
+        bool scratchPlaced = false;
+
+    };
+}
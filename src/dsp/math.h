@@ -13,6 +13,7 @@ namespace dsp {
         void init(stream<T>* a, stream<T>* b) {
             _a = a;
             _b = b;
+            out.setBufferSize(_a->getBufferSize());
             generic_block<Add<T>>::registerInput(a);
             generic_block<Add<T>>::registerInput(b);
             generic_block<Add<T>>::registerOutput(&out);
@@ -36,6 +37,8 @@ namespace dsp {
                 volk_32f_x2_add_32f(out.writeBuf, _a->readBuf, _b->readBuf, a_count);
             }
 
+            // Tags come from a
+            forwardTags(_a, &out, a_count);
             _a->flush();
             _b->flush();
             if (!out.swap(a_count)) { return -1; }
@@ -60,6 +63,7 @@ namespace dsp {
         void init(stream<T>* a, stream<T>* b) {
             _a = a;
             _b = b;
+            out.setBufferSize(_a->getBufferSize());
             generic_block<Substract<T>>::registerInput(a);
             generic_block<Substract<T>>::registerInput(b);
             generic_block<Substract<T>>::registerOutput(&out);
@@ -83,6 +87,8 @@ namespace dsp {
                 volk_32f_x2_subtract_32f(out.writeBuf, _a->readBuf, _b->readBuf, a_count);
             }
 
+            // Tags come from a
+            forwardTags(_a, &out, a_count);
             _a->flush();
             _b->flush();
             if (!out.swap(a_count)) { return -1; }
@@ -107,6 +113,7 @@ namespace dsp {
         void init(stream<T>* a, stream<T>* b) {
             _a = a;
             _b = b;
+            out.setBufferSize(_a->getBufferSize());
             generic_block<Multiply>::registerInput(a);
             generic_block<Multiply>::registerInput(b);
             generic_block<Multiply>::registerOutput(&out);
@@ -130,6 +137,8 @@ namespace dsp {
                 volk_32f_x2_multiply_32f(out.writeBuf, _a->readBuf, _b->readBuf, a_count);
             }
 
+            // Tags come from a
+            forwardTags(_a, &out, a_count);
             _a->flush();
             _b->flush();
             if (!out.swap(a_count)) { return -1; }
@@ -16,7 +16,19 @@ namespace dsp {
 
             void init(stream<uint8_t>* in) {
                 _in = in;
+
+                // Outputs only ever carry one frame section
+                TIPOut.setBufferSize(104);
+                AIPOut.setBufferSize(104);
+                AVHRRChan1Out.setBufferSize(2048);
+                AVHRRChan2Out.setBufferSize(2048);
+                AVHRRChan3Out.setBufferSize(2048);
+                AVHRRChan4Out.setBufferSize(2048);
+                AVHRRChan5Out.setBufferSize(2048);
+
                 generic_block<HRPTDemux>::registerInput(_in);
+                generic_block<HRPTDemux>::registerOutput(&TIPOut);
+                generic_block<HRPTDemux>::registerOutput(&AIPOut);
                 generic_block<HRPTDemux>::registerOutput(&AVHRRChan1Out);
                 generic_block<HRPTDemux>::registerOutput(&AVHRRChan2Out);
                 generic_block<HRPTDemux>::registerOutput(&AVHRRChan3Out);
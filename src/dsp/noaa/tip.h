@@ -12,6 +12,13 @@ namespace dsp {
 
             void init(stream<uint8_t>* in) {
                 _in = in;
+
+                // Outputs only ever carry one minor frame's worth of words
+                HIRSOut.setBufferSize(36);
+                SEMOut.setBufferSize(2);
+                DCSOut.setBufferSize(32);
+                SBUVOut.setBufferSize(4);
+
                 generic_block<TIPDemux>::registerInput(_in);
                 generic_block<TIPDemux>::registerOutput(&HIRSOut);
                 generic_block<TIPDemux>::registerOutput(&SEMOut);
@@ -147,6 +154,7 @@ namespace dsp {
                 _in = in;
                 generic_block<HIRSDemux>::registerInput(_in);
                 for (int i = 0; i < 20; i++) {
+                    radChannels[i].setBufferSize(56);
                     generic_block<HIRSDemux>::registerOutput(&radChannels[i]);
                 }
 
@@ -21,7 +21,9 @@ namespace dsp {
             float denominator = (1.0 + 2.0 * dampningFactor * _loopBandwidth + _loopBandwidth * _loopBandwidth);
             _alpha = (4 * dampningFactor * _loopBandwidth) / denominator;
             _beta = (4 * _loopBandwidth * _loopBandwidth) / denominator;
+            bandwidthBox.reset(_loopBandwidth);
 
+            out.setBufferSize(_in->getBufferSize());
             generic_block<CostasLoop<ORDER>>::registerInput(_in);
             generic_block<CostasLoop<ORDER>>::registerOutput(&out);
         }
@@ -34,19 +36,19 @@ namespace dsp {
             generic_block<CostasLoop<ORDER>>::tempStart();
         }
 
+        // Takes effect at the start of the next buffer, without stopping the block
         void setLoopBandwidth(float loopBandwidth) {
-            generic_block<CostasLoop<ORDER>>::tempStop();
-            _loopBandwidth = loopBandwidth;
-            float dampningFactor = sqrtf(2.0f) / 2.0f;
-            float denominator = (1.0 + 2.0 * dampningFactor * _loopBandwidth + _loopBandwidth * _loopBandwidth);
-            _alpha = (4 * dampningFactor * _loopBandwidth) / denominator;
-            _beta = (4 * _loopBandwidth * _loopBandwidth) / denominator;
-            generic_block<CostasLoop<ORDER>>::tempStart();
+            bandwidthBox.update([=](float& bw) { bw = loopBandwidth; });
         }
 
-        int run() {
-            int count = _in->read();
-            if (count < 0) { return -1; }
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        int process(int count, const complex_t* in, complex_t* out) {
+            if (bandwidthBox.fetch(_loopBandwidth)) {
+                float dampningFactor = sqrtf(2.0f) / 2.0f;
+                float denominator = (1.0 + 2.0 * dampningFactor * _loopBandwidth + _loopBandwidth * _loopBandwidth);
+                _alpha = (4 * dampningFactor * _loopBandwidth) / denominator;
+                _beta = (4 * _loopBandwidth * _loopBandwidth) / denominator;
+            }
 
             complex_t outVal;
             float error;
@@ -54,9 +56,9 @@ namespace dsp {
             for (int i = 0; i < count; i++) {
 
                 // Mix the VFO with the input to create the output value
-                outVal.re = (lastVCO.re*_in->readBuf[i].re) - (lastVCO.im*_in->readBuf[i].im);
-                outVal.im = (lastVCO.im*_in->readBuf[i].re) + (lastVCO.re*_in->readBuf[i].im);
-                out.writeBuf[i] = outVal;
+                outVal.re = (lastVCO.re*in[i].re) - (lastVCO.im*in[i].im);
+                outVal.im = (lastVCO.im*in[i].re) + (lastVCO.re*in[i].im);
+                out[i] = outVal;
 
                 // Calculate the phase error estimation
                 if constexpr (ORDER == 2) {
@@ -95,7 +97,17 @@ namespace dsp {
                 lastVCO.im = sinf(-vcoPhase);
 
             }
+
+            return count;
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            process(count, _in->readBuf, out.writeBuf);
             
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -105,6 +117,7 @@ namespace dsp {
 
     private:
         float _loopBandwidth = 1.0f;
+        param_mailbox<float> bandwidthBox;
 
         float _alpha; // Integral coefficient
         float _beta; // Proportional coefficient
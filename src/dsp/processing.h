@@ -1,29 +1,41 @@
 #pragma once
 #include <dsp/block.h>
+#include <dsp/utils/fir_kernels.h>
 #include <volk/volk.h>
 #include <spdlog/spdlog.h>
 #include <string.h>
 #include <stdint.h>
+#include <vector>
+
+// Phase bits the fixed point FrequencyXlator indexes its phasor table with, spurs stay about 6 dB per bit down
+#define XLATOR_FIXED_LUT_BITS   12
 
 namespace dsp {
+    // complex_int16 streams are translated in fixed point, by an NCO looking its phasors up in a
+    // table. Anything else goes through complex_t.
     template <class T>
     class FrequencyXlator : public generic_block<FrequencyXlator<T>> {
+        using sample_t = std::conditional_t<std::is_same_v<T, complex_int16>, complex_int16, complex_t>;
     public:
         FrequencyXlator() {}
 
-        FrequencyXlator(stream<complex_t>* in, float sampleRate, float freq) { init(in, sampleRate, freq); }
+        FrequencyXlator(stream<sample_t>* in, float sampleRate, float freq) { init(in, sampleRate, freq); }
 
-        void init(stream<complex_t>* in, float sampleRate, float freq) {
+        void init(stream<sample_t>* in, float sampleRate, float freq) {
             _in = in;
             _sampleRate = sampleRate;
             _freq = freq;
             phase = lv_cmake(1.0f, 0.0f);
             phaseDelta = lv_cmake(std::cos((_freq / _sampleRate) * 2.0f * FL_M_PI), std::sin((_freq / _sampleRate) * 2.0f * FL_M_PI));
+            phaseAcc = 0;
+            phaseInc = calcPhaseInc();
+            paramBox.reset({ _sampleRate, _freq });
+            out.setBufferSize(_in->getBufferSize());
             generic_block<FrequencyXlator<T>>::registerInput(_in);
             generic_block<FrequencyXlator<T>>::registerOutput(&out);
         }
 
-        void setInputSize(stream<complex_t>* in) {
+        void setInputSize(stream<sample_t>* in) {
             std::lock_guard<std::mutex> lck(generic_block<FrequencyXlator<T>>::ctrlMtx);
             generic_block<FrequencyXlator<T>>::tempStop();
             generic_block<FrequencyXlator<T>>::unregisterInput(_in);
@@ -32,30 +44,36 @@ namespace dsp {
             generic_block<FrequencyXlator<T>>::tempStart();
         }
 
+        // No need to restart, the new rate is picked up at the start of the next buffer
         void setSampleRate(float sampleRate) {
-            // No need to restart
-            _sampleRate = sampleRate;
-            phaseDelta = lv_cmake(std::cos((_freq / _sampleRate) * 2.0f * FL_M_PI), std::sin((_freq / _sampleRate) * 2.0f * FL_M_PI));
+            paramBox.update([=](params& p) { p.sampleRate = sampleRate; });
         }
 
         float getSampleRate() {
-            return _sampleRate;
+            return paramBox.get().sampleRate;
         }
 
+        // Can be called continuously (eg. to track doppler), takes effect at the start of the next buffer
         void setFrequency(float freq) {
-            // No need to restart
-            _freq = freq;
-            phaseDelta = lv_cmake(std::cos((_freq / _sampleRate) * 2.0f * FL_M_PI), std::sin((_freq / _sampleRate) * 2.0f * FL_M_PI));
+            paramBox.update([=](params& p) { p.freq = freq; });
         }
 
         float getFrequency() {
-            return _freq;
+            return paramBox.get().freq;
         }
 
         int run() {
             int count = _in->read();
             if (count < 0) { return -1; }
 
+            params p;
+            if (paramBox.fetch(p)) {
+                _sampleRate = p.sampleRate;
+                _freq = p.freq;
+                phaseDelta = lv_cmake(std::cos((_freq / _sampleRate) * 2.0f * FL_M_PI), std::sin((_freq / _sampleRate) * 2.0f * FL_M_PI));
+                phaseInc = calcPhaseInc();
+            }
+
             // TODO: Do float xlation
             if constexpr (std::is_same_v<T, float>) {
                 spdlog::error("XLATOR NOT IMPLEMENTED FOR FLOAT");
@@ -63,20 +81,61 @@ namespace dsp {
             if constexpr (std::is_same_v<T, complex_t>) {
                 volk_32fc_s32fc_x2_rotator_32fc((lv_32fc_t*)out.writeBuf, (lv_32fc_t*)_in->readBuf, phaseDelta, &phase, count);
             }
+            if constexpr (std::is_same_v<T, complex_int16>) {
+                rotateFixed(count, _in->readBuf, out.writeBuf);
+            }
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
         }
 
-        stream<complex_t> out;
+        stream<sample_t> out;
 
     private:
+        struct params {
+            float sampleRate;
+            float freq;
+        };
+
+        // Phase step in 2^32ths of a turn
+        uint32_t calcPhaseInc() {
+            return (uint32_t)(int64_t)llround(((double)_freq / (double)_sampleRate) * 4294967296.0);
+        }
+
+        // Q15 phasors for one turn
+        static const complex_int16* phasorTable() {
+            static std::vector<complex_int16> table = []() {
+                std::vector<complex_int16> tab(1 << XLATOR_FIXED_LUT_BITS);
+                for (size_t i = 0; i < tab.size(); i++) {
+                    double angle = 2.0 * FL_M_PI * (double)i / (double)tab.size();
+                    tab[i] = { (int16_t)lround(cos(angle) * 32767.0), (int16_t)lround(sin(angle) * 32767.0) };
+                }
+                return tab;
+            }();
+            return table.data();
+        }
+
+        void rotateFixed(int count, const complex_int16* in, complex_int16* out) {
+            const complex_int16* table = phasorTable();
+            for (int i = 0; i < count; i++) {
+                complex_int16 lo = table[phaseAcc >> (32 - XLATOR_FIXED_LUT_BITS)];
+                int32_t re = ((int32_t)in[i].re * lo.re) - ((int32_t)in[i].im * lo.im);
+                int32_t im = ((int32_t)in[i].re * lo.im) + ((int32_t)in[i].im * lo.re);
+                out[i] = { fir_kernels::saturate16((re + (1 << 14)) >> 15), fir_kernels::saturate16((im + (1 << 14)) >> 15) };
+                phaseAcc += phaseInc;
+            }
+        }
+
         float _sampleRate;
         float _freq;
+        param_mailbox<params> paramBox;
         lv_32fc_t phaseDelta;
         lv_32fc_t phase;
-        stream<complex_t>* _in;
+        uint32_t phaseAcc;      // Fixed point NCO
+        uint32_t phaseInc;
+        stream<sample_t>* _in;
 
     };
 
@@ -91,6 +150,7 @@ namespace dsp {
             _sampleRate = sampleRate;
             _fallRate = fallRate;
             _CorrectedFallRate = _fallRate / _sampleRate;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<AGC>::registerInput(_in);
             generic_block<AGC>::registerOutput(&out);
         }
@@ -128,6 +188,7 @@ namespace dsp {
 
             volk_32f_s32f_multiply_32f(out.writeBuf, _in->readBuf, 1.0f / level, count);
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -153,12 +214,13 @@ namespace dsp {
 
         ~FeedForwardAGC() {
             generic_block<FeedForwardAGC<T>>::stop();
-            delete[] buffer;
+            buffer::free(buffer);
         }
 
         void init(stream<T>* in) {
             _in = in;
-            buffer = new T[STREAM_BUFFER_SIZE];
+            allocBuffer();
+            out.setBufferSize(_in->getBufferSize());
             generic_block<FeedForwardAGC<T>>::registerInput(_in);
             generic_block<FeedForwardAGC<T>>::registerOutput(&out);
         }
@@ -168,6 +230,10 @@ namespace dsp {
             generic_block<FeedForwardAGC<T>>::tempStop();
             generic_block<FeedForwardAGC<T>>::unregisterInput(_in);
             _in = in;
+            T* old = buffer;
+            allocBuffer();
+            memcpy(buffer, old, inBuffer * sizeof(T));
+            buffer::free(old);
             generic_block<FeedForwardAGC<T>>::registerInput(_in);
             generic_block<FeedForwardAGC<T>>::tempStart();
         }
@@ -180,9 +246,14 @@ namespace dsp {
             float val;
 
             // Process buffer
+            uint64_t bufOffset = _in->getReadOffset() - inBuffer;
             memcpy(&buffer[inBuffer], _in->readBuf, count * sizeof(T));
             inBuffer += count;
 
+            // Output i is buffer[i], tags wait until their item's output is computed
+            const std::vector<stream_tag>& newTags = _in->getReadTags();
+            heldTags.insert(heldTags.end(), newTags.begin(), newTags.end());
+
             // If there aren't enough samples, wait for more
             if (inBuffer < sampleCount) {
                 _in->flush();
@@ -212,22 +283,36 @@ namespace dsp {
                 }
             }
 
+            size_t tagsOut = 0;
+            for (; tagsOut < heldTags.size(); tagsOut++) {
+                int64_t index = heldTags[tagsOut].offset - bufOffset;
+                if (index >= toProcess) { break; }
+                out.addTag(std::max<int64_t>(index, 0), heldTags[tagsOut].key, heldTags[tagsOut].value);
+            }
+            heldTags.erase(heldTags.begin(), heldTags.begin() + tagsOut);
+
             _in->flush();
 
             // Move rest of buffer
             memmove(buffer, &buffer[toProcess], (sampleCount - 1) * sizeof(T));
             inBuffer -= toProcess;
             
-            if (!out.swap(count)) { return -1; }
+            if (!out.swap(toProcess)) { return -1; }
             return toProcess;
         }
 
         stream<T> out;
 
     private:
+        // Holds the samples kept from the previous buffer followed by one input buffer
+        void allocBuffer() {
+            buffer = buffer::alloc<T>(_in->getBufferSize() + sampleCount);
+        }
+
         T* buffer;
         int inBuffer = 0;
         int sampleCount = 1024;
+        std::vector<stream_tag> heldTags;
         stream<T>* _in;
 
     };
@@ -243,6 +328,8 @@ namespace dsp {
             _setPoint = setPoint;
             _maxGain = maxGain;
             _rate = rate;
+            paramBox.reset({ _setPoint, _maxGain, _rate });
+            out.setBufferSize(_in->getBufferSize());
             generic_block<ComplexAGC>::registerInput(_in);
             generic_block<ComplexAGC>::registerOutput(&out);
         }
@@ -256,30 +343,45 @@ namespace dsp {
             generic_block<ComplexAGC>::tempStart();
         }
 
+        // The setters take effect at the start of the next buffer
         void setSetPoint(float setPoint) {
-            _setPoint = setPoint;
+            paramBox.update([=](params& p) { p.setPoint = setPoint; });
         }
 
         void setMaxGain(float maxGain) {
-            _maxGain = maxGain;
+            paramBox.update([=](params& p) { p.maxGain = maxGain; });
         }
 
         void setRate(float rate) {
-            _rate = rate;
+            paramBox.update([=](params& p) { p.rate = rate; });
         }
 
-        int run() {
-            int count = _in->read();
-            if (count < 0) { return -1; }
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        int process(int count, const complex_t* in, complex_t* out) {
+            params p;
+            if (paramBox.fetch(p)) {
+                _setPoint = p.setPoint;
+                _maxGain = p.maxGain;
+                _rate = p.rate;
+            }
 
             dsp::complex_t val;
             for (int i = 0; i < count; i++) {
-                val = _in->readBuf[i] * _gain;
-                out.writeBuf[i] = val;
+                val = in[i] * _gain;
+                out[i] = val;
                 _gain += (_setPoint - val.amplitude()) * _rate;
                 if (_gain > _maxGain) { _gain = _maxGain; }
             }
+            return count;
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
 
+            process(count, _in->readBuf, out.writeBuf);
+
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -288,10 +390,17 @@ namespace dsp {
         stream<complex_t> out;
 
     private:
+        struct params {
+            float setPoint;
+            float maxGain;
+            float rate;
+        };
+
         float _gain = 1.0f;
         float _setPoint = 1.0f;
         float _maxGain = 10e4;
         float _rate = 10e-4;
+        param_mailbox<params> paramBox;
         
         stream<complex_t>* _in;
 
@@ -305,6 +414,7 @@ namespace dsp {
 
         void init(stream<complex_t>* in) {
             _in = in;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<DelayImag>::registerInput(_in);
             generic_block<DelayImag>::registerOutput(&out);
         }
@@ -318,18 +428,25 @@ namespace dsp {
             generic_block<DelayImag>::tempStart();
         }
 
-        int run() {
-            int count = _in->read();
-            if (count < 0) { return -1; }
-
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        int process(int count, const complex_t* in, complex_t* out) {
             dsp::complex_t val;
             for (int i = 0; i < count; i++) {
-                val = _in->readBuf[i];
-                out.writeBuf[i].re = val.re;
-                out.writeBuf[i].im = lastIm;
+                val = in[i];
+                out[i].re = val.re;
+                out[i].im = lastIm;
                 lastIm = val.im;
             }
+            return count;
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
 
+            process(count, _in->readBuf, out.writeBuf);
+
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -355,6 +472,7 @@ namespace dsp {
         void init(stream<T>* in, float volume) {
             _in = in;
             _volume = volume;
+            out.setBufferSize(_in->getBufferSize());
             generic_block<Volume<T>>::registerInput(_in);
             generic_block<Volume<T>>::registerOutput(&out);
         }
@@ -406,6 +524,7 @@ namespace dsp {
                 }
             }
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count;
@@ -429,13 +548,14 @@ namespace dsp {
 
         ~Squelch() {
             generic_block<Squelch>::stop();
-            delete[] normBuffer;
+            buffer::free(normBuffer);
         }
 
         void init(stream<complex_t>* in, float level) {
             _in = in;
             _level = level;
-            normBuffer = new float[STREAM_BUFFER_SIZE];
+            normBuffer = buffer::alloc<float>(_in->getBufferSize());
+            out.setBufferSize(_in->getBufferSize());
             generic_block<Squelch>::registerInput(_in);
             generic_block<Squelch>::registerOutput(&out);
         }
@@ -445,6 +565,8 @@ namespace dsp {
             generic_block<Squelch>::tempStop();
             generic_block<Squelch>::unregisterInput(_in);
             _in = in;
+            buffer::free(normBuffer);
+            normBuffer = buffer::alloc<float>(_in->getBufferSize());
             generic_block<Squelch>::registerInput(_in);
             generic_block<Squelch>::tempStart();
         }
@@ -473,6 +595,7 @@ namespace dsp {
                 memset(out.writeBuf, 0, count * sizeof(complex_t));
             }
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count; 
@@ -525,7 +648,16 @@ namespace dsp {
                 return -1;
             }
 
+            // Tags follow their item into whichever output buffer it lands in
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            uint64_t inOffset = _in->getReadOffset();
+            size_t nextTag = 0;
+
             for (int i = 0; i < count; i++) {
+                while (nextTag < tags.size() && tags[nextTag].offset - inOffset <= (uint64_t)i) {
+                    out.addTag(read, tags[nextTag].key, tags[nextTag].value);
+                    nextTag++;
+                }
                 out.writeBuf[read++] = _in->readBuf[i];
                 if (read >= samples) {
                     read = 0;
@@ -557,14 +689,9 @@ namespace dsp {
 
         Threshold(stream<float>* in) { init(in); }
 
-        ~Threshold() {
-            generic_block<Threshold>::stop();
-            delete[] normBuffer;
-        }
-
         void init(stream<float>* in) {
             _in = in;
-            normBuffer = new float[STREAM_BUFFER_SIZE];
+            out.setBufferSize(_in->getBufferSize());
             generic_block<Threshold>::registerInput(_in);
             generic_block<Threshold>::registerOutput(&out);
         }
@@ -594,6 +721,7 @@ namespace dsp {
                 out.writeBuf[i] = (_in->readBuf[i] > 0.0f);
             }
 
+            forwardTags(_in, &out, count);
             _in->flush();
             if (!out.swap(count)) { return -1; }
             return count; 
@@ -603,7 +731,6 @@ namespace dsp {
 
 
     private:
-        float* normBuffer;
         float _level = -50.0f;
         stream<float>* _in;
 
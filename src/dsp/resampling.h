@@ -2,8 +2,28 @@
 #include <dsp/block.h>
 #include <dsp/window.h>
 #include <numeric>
+#include <algorithm>
+#include <cmath>
 #include <string.h>
 
+// Input buffers DecimatingFIR's work buffer holds before the history gets moved back to its start
+#define DECIMATING_FIR_BUFFERS  4
+
+// Samples PowerDecimator pushes through all of its stages at once, small enough to stay in L1
+#define POWER_DECIM_TILE        2048
+
+// Part of the output band PowerDecimator keeps free of aliasing
+#define POWER_DECIM_PASSBAND    0.8f
+
+// Most bits a fixed point CIC quantizes its input to, as many as a float has
+#define CIC_MAX_INPUT_BITS      24
+
+// Below this the fixed point CIC's quantization noise starts to show, warn about it
+#define CIC_MIN_INPUT_BITS      12
+
+// Fixed point CIC input is clipped to this magnitude, the register growth has one bit of headroom
+#define CIC_INPUT_LIMIT         1.999f
+
 namespace dsp {
     template <class T>
     class PolyphaseResampler : public generic_block<PolyphaseResampler<T>> {
@@ -14,9 +34,7 @@ namespace dsp {
 
         ~PolyphaseResampler() {
             generic_block<PolyphaseResampler<T>>::stop();
-            volk_free(buffer);
-            volk_free(taps);
-            freeTapPhases();
+            buffer::free(buffer);
         }
 
         void init(stream<T>* in, dsp::filter_window::generic_window* window, float inSampleRate, float outSampleRate) {
@@ -29,14 +47,12 @@ namespace dsp {
             _interp = _outSampleRate / _gcd;
             _decim = _inSampleRate / _gcd;
 
-            tapCount = _window->getTapCount();
-            taps = (float*)volk_malloc(tapCount * sizeof(float), volk_get_alignment());
-            _window->createTaps(taps, tapCount, _interp);
-
-            buildTapPhases();
+            phaseBox.reset(buildTapPhases());
+            usePhases();
+            allocBuffer();
 
-            buffer = (T*)volk_malloc(STREAM_BUFFER_SIZE * sizeof(T) * 2, volk_get_alignment());
-            memset(buffer, 0, STREAM_BUFFER_SIZE * sizeof(T) * 2);
+            // Never smaller than the input so that the output rate can later be raised up to the input rate
+            out.setBufferSize(std::max<int>(calcOutSize(_in->getBufferSize()), _in->getBufferSize()));
             generic_block<PolyphaseResampler<T>>::registerInput(_in);
             generic_block<PolyphaseResampler<T>>::registerOutput(&out);
         }
@@ -46,6 +62,9 @@ namespace dsp {
             generic_block<PolyphaseResampler<T>>::tempStop();
             generic_block<PolyphaseResampler<T>>::unregisterInput(_in);
             _in = in;
+            buffer::free(buffer);
+            allocBuffer();
+            checkOutputSize();
             generic_block<PolyphaseResampler<T>>::registerInput(_in);
             generic_block<PolyphaseResampler<T>>::tempStart();
         }
@@ -57,7 +76,8 @@ namespace dsp {
             int _gcd = std::gcd((int)_inSampleRate, (int)_outSampleRate);
             _interp = _outSampleRate / _gcd;
             _decim = _inSampleRate / _gcd;
-            buildTapPhases();
+            resetPhases();
+            checkOutputSize();
             generic_block<PolyphaseResampler<T>>::tempStart();
         }
 
@@ -68,7 +88,8 @@ namespace dsp {
             int _gcd = std::gcd((int)_inSampleRate, (int)_outSampleRate);
             _interp = _outSampleRate / _gcd;
             _decim = _inSampleRate / _gcd;
-            buildTapPhases();
+            resetPhases();
+            checkOutputSize();
             generic_block<PolyphaseResampler<T>>::tempStart();
         }
 
@@ -80,16 +101,11 @@ namespace dsp {
             return _decim;
         }
 
+        // The new taps are used from the next buffer on, the block keeps running. Changing the rates still restarts it.
         void updateWindow(dsp::filter_window::generic_window* window) {
             std::lock_guard<std::mutex> lck(generic_block<PolyphaseResampler<T>>::ctrlMtx);
-            generic_block<PolyphaseResampler<T>>::tempStop();
             _window = window;
-            volk_free(taps);
-            tapCount = window->getTapCount();
-            taps = (float*)volk_malloc(tapCount * sizeof(float), volk_get_alignment());
-            window->createTaps(taps, tapCount, _interp);
-            buildTapPhases();
-            generic_block<PolyphaseResampler<T>>::tempStart();
+            phaseBox.post(buildTapPhases());
         }
 
         int calcOutSize(int in) {
@@ -102,27 +118,30 @@ namespace dsp {
                 return -1;
             }
 
-            int outCount = calcOutSize(count);
+            if (phaseBox.update()) { applyPhases(); }
+
+            int outCount = std::min<int>(calcOutSize(count), out.getBufferSize());
 
             memcpy(&buffer[tapsPerPhase], _in->readBuf, count * sizeof(T));
-            _in->flush();
 
-            // Write to output
-            int outIndex = 0;
-            int _interp_m_1 = _interp - 1;
-            if constexpr (std::is_same_v<T, float>) {
-                for (int i = 0; outIndex < outCount; i += _decim) {
-                    int phase = i % _interp;
-                    volk_32f_x2_dot_prod_32f(&out.writeBuf[outIndex], &buffer[i / _interp], tapPhases[phase], tapsPerPhase);
-                    outIndex++;
+            // Output n is computed at input n * decim / interp, move each tag to the first output at or after its item
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            if (!tags.empty() && outCount > 0) {
+                uint64_t inOffset = _in->getReadOffset();
+                for (auto& tag : tags) {
+                    int64_t index = (((int64_t)(tag.offset - inOffset) * _interp) + _decim - 1) / _decim;
+                    out.addTag(std::min<int64_t>(index, outCount - 1), tag.key, tag.value);
                 }
             }
-            if constexpr (std::is_same_v<T, complex_t> || std::is_same_v<T, stereo_t>) {
-                for (int i = 0; outIndex < outCount; i += _decim) {
-                    int phase = i % _interp;
-                    volk_32fc_32f_dot_prod_32fc((lv_32fc_t*)&out.writeBuf[outIndex], (lv_32fc_t*)&buffer[(i / _interp)], tapPhases[phase], tapsPerPhase);
-                    outIndex++;
-                }
+
+            _in->flush();
+
+            // Output n is at input n * decim / interp with phase n * decim % interp. Outputs interp
+            // apart share their phase and are decim inputs apart, so each phase is one kernel call.
+            for (int first = 0; first < std::min<int>(_interp, outCount); first++) {
+                int pos = first * _decim;
+                int phaseCount = ((outCount - first) + _interp - 1) / _interp;
+                fir_kernels::dot(&out.writeBuf[first], &buffer[pos / _interp], tapPhases[pos % _interp], tapsPerPhase, phaseCount, _decim, _interp);
             }
             if (!out.swap(outCount)) { return -1; }
 
@@ -134,42 +153,70 @@ namespace dsp {
         stream<T> out;
 
     private:
-        void buildTapPhases(){
-            if(!taps){
-                return;
-            }
+        // Taps split into one filter per phase, replaced as a whole. The split itself is shared
+        // with every other resampler using the same window and interpolation.
+        struct phase_set {
+            std::shared_ptr<const polyphase_taps> design;
+        };
 
-            if(!tapPhases.empty()){
-                freeTapPhases();
-            }
+        phase_set* buildTapPhases() {
+            return new phase_set{ designPolyphaseTaps(_window, _interp) };
+        }
 
-            int phases = _interp;
-            tapsPerPhase = (tapCount+phases-1)/phases; //Integer division ceiling
+        void usePhases() {
+            tapPhases = phaseBox.get()->design->phases.data();
+            tapsPerPhase = phaseBox.get()->design->tapsPerPhase;
+        }
 
-            bufStart = &buffer[tapsPerPhase];
+        // Switch to the phases posted by updateWindow(), keeping the part of the history the new filter still needs
+        void applyPhases() {
+            int oldTapsPerPhase = tapsPerPhase;
+            usePhases();
 
-            for(int i = 0; i < phases; i++){
-                tapPhases.push_back((float*)volk_malloc(tapsPerPhase * sizeof(float), volk_get_alignment()));
+            if (tapsPerPhase > bufTapsPerPhase) {
+                T* old = buffer;
+                allocBuffer();
+                memcpy(&buffer[tapsPerPhase - oldTapsPerPhase], old, oldTapsPerPhase * sizeof(T));
+                buffer::free(old);
+            }
+            else if (tapsPerPhase > oldTapsPerPhase) {
+                memmove(&buffer[tapsPerPhase - oldTapsPerPhase], buffer, oldTapsPerPhase * sizeof(T));
+                memset(buffer, 0, (tapsPerPhase - oldTapsPerPhase) * sizeof(T));
+            }
+            else if (tapsPerPhase < oldTapsPerPhase) {
+                memmove(buffer, &buffer[oldTapsPerPhase - tapsPerPhase], tapsPerPhase * sizeof(T));
             }
+            bufStart = &buffer[tapsPerPhase];
+        }
 
-            int currentTap = 0;
-            for(int tap = 0; tap < tapsPerPhase; tap++) {
-                for (int phase = 0; phase < phases; phase++) {
-                    if(currentTap < tapCount) {
-                        tapPhases[(_interp - 1) - phase][tap] = taps[currentTap++];
-                    }
-                    else{
-                        tapPhases[(_interp - 1) - phase][tap] = 0;
-                    }
-                }
+        // Only while stopped, for a new rate
+        void resetPhases() {
+            phaseBox.reset(buildTapPhases());
+            usePhases();
+            updateBuffer();
+        }
+
+        // Work buffer holds the filter history followed by one input buffer
+        void allocBuffer() {
+            int size = _in->getBufferSize() + tapsPerPhase;
+            buffer = buffer::alloc<T>(size);
+            memset(buffer, 0, size * sizeof(T));
+            bufStart = &buffer[tapsPerPhase];
+            bufTapsPerPhase = tapsPerPhase;
+        }
+
+        void updateBuffer() {
+            if (tapsPerPhase > bufTapsPerPhase) {
+                buffer::free(buffer);
+                allocBuffer();
             }
+            bufStart = &buffer[tapsPerPhase];
         }
 
-        void freeTapPhases(){
-            for(auto & tapPhase : tapPhases){
-                volk_free(tapPhase);
+        void checkOutputSize() {
+            if (calcOutSize(_in->getBufferSize()) > out.getBufferSize()) {
+                spdlog::warn("PolyphaseResampler output buffer too small for the new rate, samples will be dropped");
             }
-            tapPhases.clear();
         }
 
         stream<T>* _in;
@@ -178,82 +225,889 @@ namespace dsp {
 
         T* bufStart;
         T* buffer;
-        int tapCount;
+        int bufTapsPerPhase;
         int _interp, _decim;
         float _inSampleRate, _outSampleRate;
-        float* taps;
 
+        // Copies of the active set's, read on every sample
         int tapsPerPhase;
-        std::vector<float*> tapPhases;
+        float* const* tapPhases;
+        ptr_mailbox<phase_set> phaseBox;
 
     };
 
-    class PowerDecimator : public generic_block<PowerDecimator> {
+    // FIR filter keeping one output out of every decim, only the kept outputs get computed.
+    // Inputs are appended to a work buffer several input buffers long, the history only
+    // needs to be moved back to its start once the buffer is full. TapT can be complex_t
+    // for complex data, eg. for a one sided bandpass from BlackmanBandpassWindow.
+    // complex_int16 data is filtered in fixed point, with real taps quantized to 16 bits.
+    template <class T, class TapT = float>
+    class DecimatingFIR : public generic_block<DecimatingFIR<T, TapT>> {
+        static_assert(std::is_same_v<TapT, float> || std::is_same_v<T, complex_t>, "Complex taps need complex data");
+        static constexpr bool FIXED = std::is_same_v<T, complex_int16>;
+        using tap_type = std::conditional_t<FIXED, int16_t, TapT>;
+    public:
+        DecimatingFIR() {}
+
+        DecimatingFIR(stream<T>* in, dsp::filter_window::generic_window* window, int decim) { init(in, window, decim); }
+
+        ~DecimatingFIR() {
+            generic_block<DecimatingFIR<T, TapT>>::stop();
+            buffer::free(buffer);
+        }
+
+        void init(stream<T>* in, dsp::filter_window::generic_window* window, int decim) {
+            _in = in;
+            _window = window;
+            _decim = decim;
+            offset = 0;
+
+            tapBox.reset(new decim_tap_set(window));
+            taps = tapBox.get()->taps;
+            tapCount = tapBox.get()->count;
+            symmetric = tapBox.get()->symmetric;
+            shift = tapBox.get()->shift;
+
+            allocBuffer();
+            outSize = calcOutSize(_in->getBufferSize());
+            out.setBufferSize(outSize);
+            generic_block<DecimatingFIR<T, TapT>>::registerInput(_in);
+            generic_block<DecimatingFIR<T, TapT>>::registerOutput(&out);
+        }
+
+        void setInput(stream<T>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<DecimatingFIR<T, TapT>>::ctrlMtx);
+            generic_block<DecimatingFIR<T, TapT>>::tempStop();
+            generic_block<DecimatingFIR<T, TapT>>::unregisterInput(_in);
+            _in = in;
+            buffer::free(buffer);
+            allocBuffer();
+            generic_block<DecimatingFIR<T, TapT>>::registerInput(_in);
+            generic_block<DecimatingFIR<T, TapT>>::tempStart();
+        }
+
+        void setDecimation(int decim) {
+            std::lock_guard<std::mutex> lck(generic_block<DecimatingFIR<T, TapT>>::ctrlMtx);
+            generic_block<DecimatingFIR<T, TapT>>::tempStop();
+            _decim = decim;
+            offset = 0;
+            if (calcOutSize(_in->getBufferSize()) > out.getBufferSize()) {
+                spdlog::warn("DecimatingFIR output buffer too small for the new decimation, samples will be dropped");
+            }
+            generic_block<DecimatingFIR<T, TapT>>::tempStart();
+        }
+
+        int getDecimation() {
+            return _decim;
+        }
+
+        // The new taps are designed right away and used from the next buffer on, the block keeps running
+        void updateWindow(dsp::filter_window::generic_window* window) {
+            std::lock_guard<std::mutex> lck(generic_block<DecimatingFIR<T, TapT>>::ctrlMtx);
+            _window = window;
+            tapBox.post(new decim_tap_set(window));
+        }
+
+        // Most outputs count inputs can give
+        int calcOutSize(int in) {
+            return (in + _decim - 1) / _decim;
+        }
+
+        // Kernel, processes count samples without touching the streams. Returns the output count,
+        // at most the size of the output stream's buffers. count must not exceed the input
+        // stream's buffer size.
+        int process(int count, const T* in, T* out) {
+            if (tapBox.update()) { applyTaps(); }
+
+            if (writeIndex + count > bufSize) {
+                memmove(buffer, &buffer[writeIndex - tapCount], tapCount * sizeof(T));
+                writeIndex = tapCount;
+            }
+            memcpy(&buffer[writeIndex], in, count * sizeof(T));
+
+            // Output for input i uses the tapCount samples ending at it
+            T* start = &buffer[writeIndex - tapCount + 1];
+            int outCount = (count - offset + _decim - 1) / _decim;
+
+            // After lowering the decimation, the outputs that don't fit are dropped
+            int keep = std::min<int>(outCount, outSize);
+            if constexpr (FIXED) {
+                fir_kernels::dotFixed(out, &start[offset], taps, tapCount, shift, keep, _decim);
+            }
+            else if constexpr (std::is_same_v<TapT, float>) {
+                fir_kernels::filter(out, &start[offset], taps, tapCount, symmetric, keep, _decim);
+            }
+            else {
+                for (int i = 0; i < keep; i++) {
+                    volk_32fc_x2_dot_prod_32fc((lv_32fc_t*)&out[i], (lv_32fc_t*)&start[offset + (i * _decim)], (lv_32fc_t*)taps, tapCount);
+                }
+            }
+            offset += (outCount * _decim) - count;
+            writeIndex += count;
+
+            return keep;
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            // Each tag goes to the first output at or after its item
+            int firstOut = offset;
+            int outCount = process(count, _in->readBuf, out.writeBuf);
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            if (!tags.empty() && outCount > 0) {
+                uint64_t inOffset = _in->getReadOffset();
+                for (auto& tag : tags) {
+                    int64_t index = std::max<int64_t>((int64_t)(tag.offset - inOffset) - firstOut + _decim - 1, 0) / _decim;
+                    out.addTag(std::min<int64_t>(index, outCount - 1), tag.key, tag.value);
+                }
+            }
+
+            _in->flush();
+
+            if (!out.swap(outCount)) { return -1; }
+            return outCount;
+        }
+
+        stream<T> out;
+
+    private:
+        typedef basic_tap_set<tap_type> decim_tap_set;
+
+        // Work buffer holds the history followed by DECIMATING_FIR_BUFFERS input buffers
+        void allocBuffer() {
+            bufSize = (_in->getBufferSize() * DECIMATING_FIR_BUFFERS) + tapCount;
+            buffer = buffer::alloc<T>(bufSize);
+            memset(buffer, 0, bufSize * sizeof(T));
+            writeIndex = tapCount;
+            bufTapCount = tapCount;
+        }
+
+        // Switch to the taps posted by updateWindow(), keeping the part of the history the new filter still needs
+        void applyTaps() {
+            taps = tapBox.get()->taps;
+            tapCount = tapBox.get()->count;
+            symmetric = tapBox.get()->symmetric;
+            shift = tapBox.get()->shift;
+
+            // Everything before writeIndex is history, only a longer filter right after the move can run short of it
+            if (tapCount > bufTapCount) {
+                T* old = buffer;
+                int keep = std::min<int>(writeIndex, tapCount);
+                int oldIndex = writeIndex;
+                allocBuffer();
+                memcpy(&buffer[tapCount - keep], &old[oldIndex - keep], keep * sizeof(T));
+                buffer::free(old);
+            }
+            else if (tapCount > writeIndex) {
+                memmove(&buffer[tapCount - writeIndex], buffer, writeIndex * sizeof(T));
+                memset(buffer, 0, (tapCount - writeIndex) * sizeof(T));
+                writeIndex = tapCount;
+            }
+        }
+
+        stream<T>* _in;
+
+        dsp::filter_window::generic_window* _window;
+
+        T* buffer;
+        int bufSize;
+        int bufTapCount;
+        int writeIndex;
+
+        int _decim;
+        int offset;     // Inputs to skip in the next buffer before the next kept one
+        int outSize;    // Size of the output stream's buffers, set at init
+
+        // Copies of the active set's, read on every sample
+        int tapCount;
+        const tap_type* taps;
+        bool symmetric;
+        int shift;
+        ptr_mailbox<decim_tap_set> tapBox;
+
+    };
+
+    // Decimates by 2^power with a cascade of half-band filters. Every other tap of a half-band
+    // filter is zero and the rest are symmetric around a center tap of 0.5, so each stage
+    // splits its input into odd and even samples: the odd ones go through a short symmetric
+    // filter and the even ones only add the center tap. Each stage is designed to keep the
+    // final output's passband free of aliasing, so the early ones at high rates are only a
+    // handful of taps. The input is processed in tiles small enough to stay in cache while
+    // they go through every stage. complex_int16 data stays in fixed point through every stage.
+    template <class T>
+    class PowerDecimator : public generic_block<PowerDecimator<T>> {
+        static_assert(std::is_same_v<T, complex_t> || std::is_same_v<T, complex_int16>, "PowerDecimator needs complex_t or complex_int16 data");
+        static constexpr bool FIXED = std::is_same_v<T, complex_int16>;
     public:
         PowerDecimator() {}
 
-        PowerDecimator(stream<complex_t>* in, unsigned int power) { init(in, power); }
+        PowerDecimator(stream<T>* in, unsigned int power) { init(in, power); }
 
-        void init(stream<complex_t>* in, unsigned int power) {
+        ~PowerDecimator() {
+            generic_block<PowerDecimator<T>>::stop();
+            freeStages();
+            buffer::free(tiles[0]);
+            buffer::free(tiles[1]);
+        }
+
+        void init(stream<T>* in, unsigned int power) {
             _in = in;
             _power = power;
-            generic_block<PowerDecimator>::registerInput(_in);
-            generic_block<PowerDecimator>::registerOutput(&out);
+            tiles[0] = buffer::alloc<T>(POWER_DECIM_TILE / 2);
+            tiles[1] = buffer::alloc<T>(POWER_DECIM_TILE / 2);
+            buildStages();
+            out.setBufferSize(_in->getBufferSize());
+            generic_block<PowerDecimator<T>>::registerInput(_in);
+            generic_block<PowerDecimator<T>>::registerOutput(&out);
         }
 
-        void setInput(stream<complex_t>* in) {
-            std::lock_guard<std::mutex> lck(generic_block<PowerDecimator>::ctrlMtx);
-            generic_block<PowerDecimator>::tempStop();
-            generic_block<PowerDecimator>::unregisterInput(_in);
+        void setInput(stream<T>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<PowerDecimator<T>>::ctrlMtx);
+            generic_block<PowerDecimator<T>>::tempStop();
+            generic_block<PowerDecimator<T>>::unregisterInput(_in);
             _in = in;
-            generic_block<PowerDecimator>::registerInput(_in);
-            generic_block<PowerDecimator>::tempStart();
+            generic_block<PowerDecimator<T>>::registerInput(_in);
+            generic_block<PowerDecimator<T>>::tempStart();
         }
 
         void setPower(unsigned int power) {
-            std::lock_guard<std::mutex> lck(generic_block<PowerDecimator>::ctrlMtx);
-            generic_block<PowerDecimator>::tempStop();
+            std::lock_guard<std::mutex> lck(generic_block<PowerDecimator<T>>::ctrlMtx);
+            generic_block<PowerDecimator<T>>::tempStop();
             _power = power;
-            generic_block<PowerDecimator>::tempStart();
+            freeStages();
+            buildStages();
+            generic_block<PowerDecimator<T>>::tempStart();
+        }
+
+        // Kernel, processes count samples without touching the streams. Returns the output count.
+        int process(int count, const T* in, T* out) {
+            if (stages.empty()) {
+                memcpy(out, in, count * sizeof(T));
+                return count;
+            }
+
+            int outCount = 0;
+            for (int done = 0; done < count; done += POWER_DECIM_TILE) {
+                int n = std::min<int>(POWER_DECIM_TILE, count - done);
+                const T* src = &in[done];
+                for (size_t i = 0; i < stages.size(); i++) {
+                    T* dst = (i == stages.size() - 1) ? &out[outCount] : tiles[i & 1];
+                    n = stages[i]->process(src, n, dst);
+                    src = dst;
+                }
+                outCount += n;
+            }
+            return outCount;
         }
 
         int run() {
             int count = _in->read();
             if (count < 0) { return -1; }
 
-            if (_power == 0) {
-                memcpy(out.writeBuf, _in->readBuf, count * sizeof(complex_t));
+            int outCount = process(count, _in->readBuf, out.writeBuf);
+
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            if (!tags.empty() && outCount > 0) {
+                uint64_t inOffset = _in->getReadOffset();
+                for (auto& tag : tags) {
+                    out.addTag(std::min<int64_t>((tag.offset - inOffset) >> _power, outCount - 1), tag.key, tag.value);
+                }
+            }
+
+            _in->flush();
+
+            if (!out.swap(outCount)) { return -1; }
+            return outCount;
+        }
+
+        stream<T> out;
+
+    private:
+        class halfband_stage {
+        public:
+            // passband is the edge of the band to keep, relative to this stage's input rate
+            halfband_stage(float passband) {
+                // Same tap count estimate as BlackmanWindow, rounded up to a half-band length of 4 * pairs - 1
+                float transWidth = 0.5f - (2.0f * passband);
+                int tapCount = 4.0f / transWidth;
+                pairs = std::max<int>((tapCount + 4) / 4, 2);
+                int len = (4 * pairs) - 1;
+                int center = len / 2;
+
+                // Non-zero taps at odd distances from the center, scaled for a DC gain of 1
+                taps = (float*)volk_malloc(2 * pairs * sizeof(float), volk_get_alignment());
+                float sum = 0.0f;
+                for (int i = 0; i < pairs; i++) {
+                    int n = center - ((2 * i) + 1);
+                    float t = (float)(n - center);
+                    float pos = (float)(n + 1) / (float)(len + 1);
+                    float window = 0.42f - (0.5f * cos(2.0f * FL_M_PI * pos)) + (0.08f * cos(4.0f * FL_M_PI * pos));
+                    taps[pairs - 1 - i] = (sin(FL_M_PI * t / 2.0f) / (FL_M_PI * t)) * window;
+                    sum += taps[pairs - 1 - i];
+                }
+                for (int i = 0; i < pairs; i++) {
+                    taps[i] *= 0.25f / sum;
+                    taps[(2 * pairs) - 1 - i] = taps[i];
+                }
+                if constexpr (FIXED) {
+                    shift = fir_kernels::fixedTapShift(taps, 2 * pairs);
+                    fixedTaps = (int16_t*)volk_malloc(4 * pairs * sizeof(int16_t), volk_get_alignment());
+                    fir_kernels::packFixedTaps(fixedTaps, taps, 2 * pairs, shift);
+                }
+
+                odd = buffer::alloc<T>((2 * pairs) + (POWER_DECIM_TILE / 2));
+                even = buffer::alloc<T>(pairs + (POWER_DECIM_TILE / 2));
+                memset(odd, 0, ((2 * pairs) + (POWER_DECIM_TILE / 2)) * sizeof(T));
+                memset(even, 0, (pairs + (POWER_DECIM_TILE / 2)) * sizeof(T));
             }
-            else if (_power == 1) {
-                for (int j = 0; j < count; j += 2) {
-                    out.writeBuf[j / 2].re = (_in->readBuf[j].re + _in->readBuf[j + 1].re) * 0.5f;
-                    out.writeBuf[j / 2].im = (_in->readBuf[j].im + _in->readBuf[j + 1].im) * 0.5f;
+
+            ~halfband_stage() {
+                volk_free(taps);
+                if constexpr (FIXED) { volk_free(fixedTaps); }
+                buffer::free(odd);
+                buffer::free(even);
+            }
+
+            // Output m comes from the pair (in[2m], in[2m+1]), a sample left without its pair waits for the next call.
+            // count must not exceed POWER_DECIM_TILE.
+            int process(const T* in, int count, T* out) {
+                T* e = &even[pairs - 1];
+                T* o = &odd[(2 * pairs) - 1];
+                int n = 0;
+                int i = 0;
+                if (hasHalf && count > 0) {
+                    e[0] = half;
+                    o[0] = in[0];
+                    hasHalf = false;
+                    n = 1;
+                    i = 1;
+                }
+                for (; i + 1 < count; i += 2) {
+                    e[n] = in[i];
+                    o[n] = in[i + 1];
+                    n++;
+                }
+                if (i < count) {
+                    half = in[i];
+                    hasHalf = true;
+                }
+
+                // Odd samples through the symmetric taps, plus the even sample under the center tap
+                if constexpr (FIXED) {
+                    fir_kernels::dotFixed(out, odd, fixedTaps, 2 * pairs, shift, n);
+                    for (int j = 0; j < n; j++) {
+                        out[j].re = fir_kernels::saturate16((int32_t)out[j].re + ((even[j].re + 1) >> 1));
+                        out[j].im = fir_kernels::saturate16((int32_t)out[j].im + ((even[j].im + 1) >> 1));
+                    }
+                }
+                else {
+                    fir_kernels::filter(out, odd, taps, 2 * pairs, true, n);
+                    for (int j = 0; j < n; j++) {
+                        out[j].re += 0.5f * even[j].re;
+                        out[j].im += 0.5f * even[j].im;
+                    }
+                }
+
+                memmove(odd, &odd[n], ((2 * pairs) - 1) * sizeof(T));
+                memmove(even, &even[n], (pairs - 1) * sizeof(T));
+                return n;
+            }
+
+        private:
+            int pairs;
+            float* taps;
+            int16_t* fixedTaps;     // Fixed point only
+            int shift;
+            T* odd;     // Filter history followed by the odd samples of the tile
+            T* even;    // Center tap delay followed by the even samples of the tile
+            bool hasHalf = false;
+            T half;
+        };
+
+        void buildStages() {
+            // Stage i halves the rate from 2^(power - i) times the output rate
+            for (unsigned int i = 0; i < _power; i++) {
+                float passband = POWER_DECIM_PASSBAND / (float)(1 << ((_power - i) + 1));
+                stages.push_back(new halfband_stage(passband));
+            }
+        }
+
+        void freeStages() {
+            for (auto& stage : stages) {
+                delete stage;
+            }
+            stages.clear();
+        }
+
+        unsigned int _power = 0;
+        stream<T>* _in;
+
+        std::vector<halfband_stage*> stages;
+        T* tiles[2];
+
+    };
+
+    enum cic_arith {
+        CIC_FIXED,      // Integrators and combs in wrapping 64 bit integers, exact however long it runs
+        CIC_FLOAT       // CICTaps through the FIR kernels, float integrators would drift without bound
+    };
+
+    // Bits the fixed point CIC quantizes its input to, the (rate * delay)^order gain gets the rest of the 64
+    inline int cicInputBits(int order, int rate, int delay) {
+        int growth = ceil((double)order * log2((double)rate * (double)delay));
+        return std::min<int>(CIC_MAX_INPUT_BITS, 63 - growth);
+    }
+
+    // CIC decimator: order integrators at the input rate, decimation by decim, then order combs
+    // with a differential delay of delay at the output rate. It only adds, so it suits large
+    // decimations of wideband input. Its passband droops like sinc^order, follow it with a
+    // filter from CICCompensationTaps. The gain is 1 at DC.
+    // In CIC_FIXED the registers wrap around, which is harmless as long as the output fits, so
+    // the input gets quantized to what the gain leaves of 64 bits. CIC_FLOAT computes the same
+    // response as a FIR over the kept outputs, it costs order multiplies per input instead.
+    // complex_int16 input goes into the registers as is, always in CIC_FIXED, and comes out as
+    // complex_t so that the decimation's extra bits of precision aren't thrown away.
+    template <class T>
+    class CICDecimator : public generic_block<CICDecimator<T>> {
+        static_assert(std::is_same_v<T, float> || std::is_same_v<T, complex_t> || std::is_same_v<T, complex_int16>, "CIC needs float, complex or complex_int16 data");
+        static constexpr bool FIXED_INPUT = std::is_same_v<T, complex_int16>;
+        using out_type = std::conditional_t<FIXED_INPUT, complex_t, T>;
+    public:
+        CICDecimator() {}
+
+        CICDecimator(stream<T>* in, int decim, int order = 4, int delay = 1, cic_arith arith = CIC_FIXED) { init(in, decim, order, delay, arith); }
+
+        ~CICDecimator() {
+            generic_block<CICDecimator<T>>::stop();
+            freeState();
+        }
+
+        void init(stream<T>* in, int decim, int order = 4, int delay = 1, cic_arith arith = CIC_FIXED) {
+            _in = in;
+            _decim = decim;
+            _order = order;
+            _delay = delay;
+            _arith = FIXED_INPUT ? CIC_FIXED : arith;
+            allocState();
+            outSize = calcOutSize(_in->getBufferSize());
+            out.setBufferSize(outSize);
+            generic_block<CICDecimator<T>>::registerInput(_in);
+            generic_block<CICDecimator<T>>::registerOutput(&out);
+        }
+
+        void setInput(stream<T>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<CICDecimator<T>>::ctrlMtx);
+            generic_block<CICDecimator<T>>::tempStop();
+            generic_block<CICDecimator<T>>::unregisterInput(_in);
+            _in = in;
+            freeState();
+            allocState();
+            generic_block<CICDecimator<T>>::registerInput(_in);
+            generic_block<CICDecimator<T>>::tempStart();
+        }
+
+        void setDecimation(int decim) {
+            std::lock_guard<std::mutex> lck(generic_block<CICDecimator<T>>::ctrlMtx);
+            generic_block<CICDecimator<T>>::tempStop();
+            _decim = decim;
+            freeState();
+            allocState();
+            if (calcOutSize(_in->getBufferSize()) > out.getBufferSize()) {
+                spdlog::warn("CICDecimator output buffer too small for the new decimation, samples will be dropped");
+            }
+            generic_block<CICDecimator<T>>::tempStart();
+        }
+
+        void setOrder(int order) {
+            std::lock_guard<std::mutex> lck(generic_block<CICDecimator<T>>::ctrlMtx);
+            generic_block<CICDecimator<T>>::tempStop();
+            _order = order;
+            freeState();
+            allocState();
+            generic_block<CICDecimator<T>>::tempStart();
+        }
+
+        int getDecimation() {
+            return _decim;
+        }
+
+        int getOrder() {
+            return _order;
+        }
+
+        int getDelay() {
+            return _delay;
+        }
+
+        // Most outputs count inputs can give
+        int calcOutSize(int in) {
+            return (in + _decim - 1) / _decim;
+        }
+
+        // Kernel, processes count samples without touching the streams. Returns the output count,
+        // at most the size of the output stream's buffers. count must not exceed the input
+        // stream's buffer size.
+        int process(int count, const T* in, out_type* out) {
+            if constexpr (!FIXED_INPUT) {
+                if (_arith == CIC_FLOAT) {
+                    // Output for input i uses the tapCount samples ending at it
+                    memcpy(&buffer[tapCount], in, count * sizeof(T));
+                    int outCount = (count - offset + _decim - 1) / _decim;
+
+                    // After lowering the decimation, the outputs that don't fit are dropped
+                    int keep = std::min<int>(outCount, outSize);
+                    fir_kernels::filter(out, &buffer[offset + 1], taps, tapCount, true, keep, _decim);
+                    offset += (outCount * _decim) - count;
+                    memmove(buffer, &buffer[count], tapCount * sizeof(T));
+                    return keep;
+                }
+            }
+
+            float* y = (float*)out;
+            int outCount = 0;
+            for (int i = 0; i < count; i++) {
+                for (int c = 0; c < CHANNELS; c++) {
+                    uint64_t s;
+                    if constexpr (FIXED_INPUT) {
+                        s = (uint64_t)(int64_t)((const int16_t*)in)[(i * CHANNELS) + c];
+                    }
+                    else {
+                        float val = std::clamp<float>(((const float*)in)[(i * CHANNELS) + c], -CIC_INPUT_LIMIT, CIC_INPUT_LIMIT);
+                        s = (uint64_t)(int64_t)llrintf(val * inScale);
+                    }
+                    uint64_t* acc = &integ[c * _order];
+                    for (int k = 0; k < _order; k++) {
+                        s = (acc[k] += s);
+                    }
+                }
+                if (++phase < _decim) { continue; }
+                phase = 0;
+
+                for (int c = 0; c < CHANNELS; c++) {
+                    uint64_t s = integ[(c * _order) + _order - 1];
+                    uint64_t* line = &combs[c * _order * _delay];
+                    for (int k = 0; k < _order; k++) {
+                        uint64_t& old = line[(k * _delay) + combIndex];
+                        uint64_t diff = s - old;
+                        old = s;
+                        s = diff;
+                    }
+                    if (outCount < outSize) { y[(outCount * CHANNELS) + c] = (double)(int64_t)s * outScale; }
+                }
+                if (++combIndex == _delay) { combIndex = 0; }
+                outCount++;
+            }
+            return std::min<int>(outCount, outSize);
+        }
+
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            // Each tag goes to the first output at or after its item
+            int firstOut = (_arith == CIC_FLOAT) ? offset : (_decim - 1 - phase);
+            int outCount = process(count, _in->readBuf, out.writeBuf);
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            if (!tags.empty() && outCount > 0) {
+                uint64_t inOffset = _in->getReadOffset();
+                for (auto& tag : tags) {
+                    int64_t index = std::max<int64_t>((int64_t)(tag.offset - inOffset) - firstOut + _decim - 1, 0) / _decim;
+                    out.addTag(std::min<int64_t>(index, outCount - 1), tag.key, tag.value);
                 }
-                count /= 2;
             }
 
             _in->flush();
 
-            if (_power > 1) {
-                for (int i = 1; i < _power; i++) {
-                    for (int j = 0; j < count; j += 2) {
-                        out.writeBuf[j / 2].re = (_in->readBuf[j].re + _in->readBuf[j + 1].re) * 0.5f;
-                        out.writeBuf[j / 2].im = (_in->readBuf[j].im + _in->readBuf[j + 1].im) * 0.5f;
+            if (!out.swap(outCount)) { return -1; }
+            return outCount;
+        }
+
+        stream<out_type> out;
+
+    private:
+        static const int CHANNELS = sizeof(out_type) / sizeof(float);
+
+        void allocState() {
+            if (_arith == CIC_FLOAT) {
+                CICTaps win(_order, _decim, _delay);
+                design = designTaps<float>(&win);
+                taps = design->taps;
+                tapCount = design->count;
+                buffer = buffer::alloc<T>(tapCount + _in->getBufferSize());
+                memset(buffer, 0, (tapCount + _in->getBufferSize()) * sizeof(T));
+
+                // Same output alignment as the fixed point form, after every decim inputs
+                offset = _decim - 1;
+                return;
+            }
+
+            int bits = cicInputBits(_order, _decim, _delay);
+            if constexpr (FIXED_INPUT) {
+                // Integer samples go in as they are, they only need room for their 16 bits
+                if (bits < 16) {
+                    spdlog::error("CICDecimator gain too large for 16 bit input, use a lower order or decimation");
+                }
+                inScale = 32768.0f;
+            }
+            else {
+                if (bits < CIC_MIN_INPUT_BITS) {
+                    spdlog::warn("CICDecimator only has {0} bits left for its input, use a lower order or decimation", bits);
+                }
+                inScale = ldexp(1.0f, bits - 1);
+            }
+            outScale = 1.0 / (inScale * pow((double)_decim * (double)_delay, _order));
+            integ.assign(CHANNELS * _order, 0);
+            combs.assign(CHANNELS * _order * _delay, 0);
+            phase = 0;
+            combIndex = 0;
+        }
+
+        void freeState() {
+            if (_arith == CIC_FLOAT) {
+                design.reset();
+                buffer::free(buffer);
+            }
+        }
+
+        stream<T>* _in;
+
+        int _decim;
+        int _order;
+        int _delay;
+        cic_arith _arith;
+        int outSize;                    // Size of the output stream's buffers, set at init
+
+        // CIC_FIXED
+        float inScale;
+        double outScale;
+        std::vector<uint64_t> integ;    // order integrators per channel
+        std::vector<uint64_t> combs;    // delay samples of history per comb and channel
+        int phase;                      // Inputs since the last output
+        int combIndex;
+
+        // CIC_FLOAT
+        std::shared_ptr<const designed_taps<float>> design;
+        const float* taps;
+        int tapCount;
+        T* buffer;                      // History followed by the input buffer
+        int offset;                     // Inputs to skip in the next buffer before the next kept one
+
+    };
+
+    // CIC interpolator: order combs with a differential delay of delay at the input rate, zero
+    // stuffing by interp, then order integrators at the output rate. Images fall in the CIC's
+    // nulls, its droop can be corrected before it with a filter from CICCompensationTaps. The
+    // gain is 1 at DC. CIC_FIXED and CIC_FLOAT work as for CICDecimator, CIC_FLOAT splitting
+    // the taps into one short filter per output phase.
+    template <class T>
+    class CICInterpolator : public generic_block<CICInterpolator<T>> {
+        static_assert(std::is_same_v<T, float> || std::is_same_v<T, complex_t>, "CIC needs float or complex data");
+    public:
+        CICInterpolator() {}
+
+        CICInterpolator(stream<T>* in, int interp, int order = 4, int delay = 1, cic_arith arith = CIC_FIXED) { init(in, interp, order, delay, arith); }
+
+        ~CICInterpolator() {
+            generic_block<CICInterpolator<T>>::stop();
+            freeState();
+        }
+
+        void init(stream<T>* in, int interp, int order = 4, int delay = 1, cic_arith arith = CIC_FIXED) {
+            _in = in;
+            _interp = interp;
+            _order = order;
+            _delay = delay;
+            _arith = arith;
+            allocState();
+            outSize = calcOutSize(_in->getBufferSize());
+            out.setBufferSize(outSize);
+            generic_block<CICInterpolator<T>>::registerInput(_in);
+            generic_block<CICInterpolator<T>>::registerOutput(&out);
+        }
+
+        void setInput(stream<T>* in) {
+            std::lock_guard<std::mutex> lck(generic_block<CICInterpolator<T>>::ctrlMtx);
+            generic_block<CICInterpolator<T>>::tempStop();
+            generic_block<CICInterpolator<T>>::unregisterInput(_in);
+            _in = in;
+            freeState();
+            allocState();
+            generic_block<CICInterpolator<T>>::registerInput(_in);
+            generic_block<CICInterpolator<T>>::tempStart();
+        }
+
+        void setInterpolation(int interp) {
+            std::lock_guard<std::mutex> lck(generic_block<CICInterpolator<T>>::ctrlMtx);
+            generic_block<CICInterpolator<T>>::tempStop();
+            _interp = interp;
+            freeState();
+            allocState();
+            if (calcOutSize(_in->getBufferSize()) > out.getBufferSize()) {
+                spdlog::warn("CICInterpolator output buffer too small for the new interpolation, samples will be dropped");
+            }
+            generic_block<CICInterpolator<T>>::tempStart();
+        }
+
+        void setOrder(int order) {
+            std::lock_guard<std::mutex> lck(generic_block<CICInterpolator<T>>::ctrlMtx);
+            generic_block<CICInterpolator<T>>::tempStop();
+            _order = order;
+            freeState();
+            allocState();
+            generic_block<CICInterpolator<T>>::tempStart();
+        }
+
+        int getInterpolation() {
+            return _interp;
+        }
+
+        int getOrder() {
+            return _order;
+        }
+
+        int getDelay() {
+            return _delay;
+        }
+
+        int calcOutSize(int in) {
+            return in * _interp;
+        }
+
+        // Kernel, processes count samples without touching the streams. Returns the output count,
+        // at most the size of the output stream's buffers. count must not exceed the input
+        // stream's buffer size.
+        int process(int count, const T* in, T* out) {
+            // After raising the interpolation, the outputs that don't fit are dropped
+            int keep = std::min<int>(count * _interp, outSize);
+
+            if (_arith == CIC_FLOAT) {
+                // Output phase p of input i uses the phaseLen samples ending at it
+                memcpy(&buffer[phaseLen], in, count * sizeof(T));
+                for (int p = 0; p < std::min<int>(_interp, keep); p++) {
+                    int phaseCount = (keep - p + _interp - 1) / _interp;
+                    fir_kernels::dot(&out[p], &buffer[1], &phaseTaps[p * phaseLen], phaseLen, phaseCount, 1, _interp);
+                }
+                memmove(buffer, &buffer[count], phaseLen * sizeof(T));
+                return keep;
+            }
+
+            const float* x = (const float*)in;
+            float* y = (float*)out;
+            uint64_t combOut[CHANNELS];
+            for (int i = 0; i < count; i++) {
+                for (int c = 0; c < CHANNELS; c++) {
+                    float val = std::clamp<float>(x[(i * CHANNELS) + c], -CIC_INPUT_LIMIT, CIC_INPUT_LIMIT);
+                    uint64_t s = (uint64_t)(int64_t)llrintf(val * inScale);
+                    uint64_t* line = &combs[c * _order * _delay];
+                    for (int k = 0; k < _order; k++) {
+                        uint64_t& old = line[(k * _delay) + combIndex];
+                        uint64_t diff = s - old;
+                        old = s;
+                        s = diff;
+                    }
+                    combOut[c] = s;
+                }
+                if (++combIndex == _delay) { combIndex = 0; }
+
+                // The comb output followed by interp - 1 zeros
+                for (int r = 0; r < _interp; r++) {
+                    for (int c = 0; c < CHANNELS; c++) {
+                        uint64_t s = r ? 0 : combOut[c];
+                        uint64_t* acc = &integ[c * _order];
+                        for (int k = 0; k < _order; k++) {
+                            s = (acc[k] += s);
+                        }
+                        int n = (i * _interp) + r;
+                        if (n < keep) { y[(n * CHANNELS) + c] = (double)(int64_t)s * outScale; }
                     }
-                    count /= 2;
                 }
             }
-            
-            if (!out.swap(count)) { return -1; }
-            return count; 
+            return keep;
         }
 
-        stream<complex_t> out;
+        int run() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            int outCount = process(count, _in->readBuf, out.writeBuf);
+            const std::vector<stream_tag>& tags = _in->getReadTags();
+            if (!tags.empty() && outCount > 0) {
+                uint64_t inOffset = _in->getReadOffset();
+                for (auto& tag : tags) {
+                    out.addTag(std::min<int64_t>((tag.offset - inOffset) * _interp, outCount - 1), tag.key, tag.value);
+                }
+            }
+
+            _in->flush();
+
+            if (!out.swap(outCount)) { return -1; }
+            return outCount;
+        }
 
+        stream<T> out;
 
     private:
-        unsigned int _power = 0;
-        stream<complex_t>* _in;
+        static const int CHANNELS = sizeof(T) / sizeof(float);
+
+        void allocState() {
+            if (_arith == CIC_FLOAT) {
+                // Phase p gets taps p, p + interp, ..., reversed since the kernels take the oldest sample first
+                CICTaps win(_order, _interp, _delay);
+                int tapCount = win.getTapCount();
+                std::vector<float> taps(tapCount);
+                win.createTaps(taps.data(), tapCount, _interp);
+                phaseLen = (tapCount + _interp - 1) / _interp;
+                phaseTaps = (float*)volk_malloc(_interp * phaseLen * sizeof(float), volk_get_alignment());
+                for (int p = 0; p < _interp; p++) {
+                    for (int k = 0; k < phaseLen; k++) {
+                        int n = p + ((phaseLen - 1 - k) * _interp);
+                        phaseTaps[(p * phaseLen) + k] = (n < tapCount) ? taps[n] : 0.0f;
+                    }
+                }
+                buffer = buffer::alloc<T>(phaseLen + _in->getBufferSize());
+                memset(buffer, 0, (phaseLen + _in->getBufferSize()) * sizeof(T));
+                return;
+            }
+
+            int bits = cicInputBits(_order, _interp, _delay);
+            if (bits < CIC_MIN_INPUT_BITS) {
+                spdlog::warn("CICInterpolator only has {0} bits left for its input, use a lower order or interpolation", bits);
+            }
+            inScale = ldexp(1.0f, bits - 1);
+            outScale = (double)_interp / (inScale * pow((double)_interp * (double)_delay, _order));
+            integ.assign(CHANNELS * _order, 0);
+            combs.assign(CHANNELS * _order * _delay, 0);
+            combIndex = 0;
+        }
+
+        void freeState() {
+            if (_arith == CIC_FLOAT) {
+                volk_free(phaseTaps);
+                buffer::free(buffer);
+            }
+        }
+
+        stream<T>* _in;
+
+        int _interp;
+        int _order;
+        int _delay;
+        cic_arith _arith;
+        int outSize;                    // Size of the output stream's buffers, set at init
+
+        // CIC_FIXED
+        float inScale;
+        double outScale;
+        std::vector<uint64_t> integ;    // order integrators per channel
+        std::vector<uint64_t> combs;    // delay samples of history per comb and channel
+        int combIndex;
+
+        // CIC_FLOAT
+        float* phaseTaps;               // phaseLen taps per output phase
+        int phaseLen;
+        T* buffer;                      // History followed by the input buffer
 
     };
 }
\ No newline at end of file
@@ -13,6 +13,11 @@ namespace dsp {
 
         Splitter(stream<T>* in) { init(in); }
 
+        ~Splitter() {
+            generic_block<Splitter>::stop();
+            freePool();
+        }
+
         void init(stream<T>* in) {
             _in = in;
             generic_block<Splitter>::registerInput(_in);
@@ -43,22 +48,147 @@ namespace dsp {
             generic_block<Splitter>::tempStart();
         }
 
+        // In zero-copy mode, every output reads the same input buffer instead of its own copy.
+        // A buffer goes back to the pool once the last output flushes it. No output can lag
+        // more than maxLag buffers (or its own depth) behind before the splitter waits for it.
+        // Outputs must not modify their readBuf in this mode.
+        void setZeroCopy(bool zeroCopy, int maxLag = 4) {
+            std::lock_guard<std::mutex> lck(generic_block<Splitter>::ctrlMtx);
+            generic_block<Splitter>::tempStop();
+            _zeroCopy = zeroCopy;
+            _maxLag = std::max<int>(maxLag, 1);
+            if (_zeroCopy) { allocPool(); }
+            generic_block<Splitter>::tempStart();
+        }
+
+        bool getZeroCopy() {
+            return _zeroCopy;
+        }
+
     private:
+        // Input buffer shared by all outputs
+        class SharedBuffer : public buffer_ref {
+        public:
+            void release() {
+                if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    owner->recycle(this);
+                }
+            }
+
+            Splitter<T>* owner;
+            T* data;
+            int size;
+            std::atomic<int> refs{0};
+        };
+
         int run() {
+            if (_zeroCopy) { return runShared(); }
+
             // TODO: If too slow, buffering might be necessary
             int count = _in->read();
             if (count < 0) { return -1; }
             for (const auto& stream : out) {
                 memcpy(stream->writeBuf, _in->readBuf, count * sizeof(T));
+                forwardTags(_in, stream, count);
                 if (!stream->swap(count)) { return -1; }
             }
             _in->flush();
             return count;
         }
 
+        int runShared() {
+            int count = _in->read();
+            if (count < 0) { return -1; }
+
+            // Get a free buffer, this waits if the slowest output is too far behind
+            SharedBuffer* buf;
+            {
+                std::unique_lock<std::mutex> lck(poolMtx);
+                poolCV.wait(lck, [this]{ return (!freeBufs.empty() || poolStop); });
+                if (poolStop) { return -1; }
+                buf = freeBufs.back();
+                freeBufs.pop_back();
+            }
+
+            // Tags are kept by the streams, not the buffer, so every output gets its own copy
+            for (const auto& stream : out) {
+                forwardTags(_in, stream, count);
+            }
+
+            // Trade it for the input buffer so the input can be flushed right away
+            if (buf->size < _in->getBufferSize()) {
+                buffer::free(buf->data);
+                buf->data = buffer::alloc<T>(_in->getBufferSize());
+            }
+            buf->data = _in->exchangeReadBuf(buf->data);
+            buf->size = _in->getBufferSize();
+            _in->flush();
+
+            // One reference per output plus one held while publishing
+            int outCount = out.size();
+            buf->refs.store(outCount + 1, std::memory_order_relaxed);
+            for (int i = 0; i < outCount; i++) {
+                if (!out[i]->swapShared(buf->data, count, buf)) {
+                    for (int j = i; j < outCount; j++) { buf->release(); }
+                    buf->release();
+                    return -1;
+                }
+            }
+            buf->release();
+
+            return count;
+        }
+
+        void recycle(SharedBuffer* buf) {
+            {
+                std::lock_guard<std::mutex> lck(poolMtx);
+                freeBufs.push_back(buf);
+            }
+            poolCV.notify_one();
+        }
+
+        void allocPool() {
+            std::lock_guard<std::mutex> lck(poolMtx);
+            while ((int)pool.size() < _maxLag) {
+                SharedBuffer* buf = new SharedBuffer;
+                buf->owner = this;
+                buf->size = _in->getBufferSize();
+                buf->data = buffer::alloc<T>(buf->size);
+                pool.push_back(buf);
+                freeBufs.push_back(buf);
+            }
+        }
+
+        void freePool() {
+            for (auto& buf : pool) {
+                buffer::free(buf->data);
+                delete buf;
+            }
+            pool.clear();
+            freeBufs.clear();
+        }
+
+        void doStop() {
+            {
+                std::lock_guard<std::mutex> lck(poolMtx);
+                poolStop = true;
+            }
+            poolCV.notify_all();
+            generic_block<Splitter>::doStop();
+            poolStop = false;
+        }
+
         stream<T>* _in;
         std::vector<stream<T>*> out;
 
+        bool _zeroCopy = false;
+        int _maxLag = 4;
+        std::vector<SharedBuffer*> pool;
+        std::vector<SharedBuffer*> freeBufs;
+        std::mutex poolMtx;
+        std::condition_variable poolCV;
+        bool poolStop = false;
+
     };
 
 
@@ -0,0 +1,552 @@
+#pragma once
+#include <dsp/block.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Maximum number of run() calls a block gets per dispatch before going to the back of the queue
+#define SCHEDULER_TASK_BATCH    16
+
+namespace dsp {
+    // Task bookkeeping shared by the schedulers that run blocks on their own worker threads.
+    // A block is only dispatched once all its inputs have data and all its outputs
+    // have room, so its run() never waits inside the stream. Blocks that swap several
+    // times per run() or that wait on something that isn't a registered stream (hardware
+    // sources, RingBufferSink, etc) can still block a worker and should keep their own thread.
+    class task_scheduler : public generic_scheduler {
+    public:
+        virtual ~task_scheduler() {
+            for (auto& [block, task] : tasks) {
+                delete task;
+            }
+        }
+
+        void attach(generic_unnamed_block* block, const std::vector<untyped_steam*>& inputs, const std::vector<untyped_steam*>& outputs) {
+            // Tasks are kept until the scheduler is destroyed since a stream might still be notifying them
+            Task* task;
+            {
+                std::lock_guard<std::mutex> lck(tasksMtx);
+                auto it = tasks.find(block);
+                if (it == tasks.end()) {
+                    task = new Task(this, block);
+                    tasks[block] = task;
+                }
+                else {
+                    task = it->second;
+                }
+            }
+            task->inputs = inputs;
+            task->outputs = outputs;
+            task->detached = false;
+            task->ended = false;
+            task->started = false;
+
+            for (auto& in : inputs) { in->setReaderListener(task); }
+            for (auto& out : outputs) { out->setWriterListener(task); }
+
+            // Kick it once in case it's already ready
+            schedule(task);
+        }
+
+        void detach(generic_unnamed_block* block) {
+            Task* task;
+            {
+                std::lock_guard<std::mutex> lck(tasksMtx);
+                auto it = tasks.find(block);
+                if (it == tasks.end()) { return; }
+                task = it->second;
+            }
+
+            // Once detached is set push() refuses the task, so pulling it out of the queues is final
+            task->detached = true;
+            if (unqueue(task)) { setIdle(task); }
+
+            for (auto& in : task->inputs) { in->setReaderListener(NULL); }
+            for (auto& out : task->outputs) { out->setWriterListener(NULL); }
+
+            // Wait for a run in progress to finish
+            std::unique_lock<std::mutex> lck(doneMtx);
+            doneCV.wait(lck, [task]{ return task->state.load() == TASK_IDLE; });
+        }
+
+    protected:
+        enum {
+            TASK_IDLE,
+            TASK_QUEUED,
+            TASK_RUNNING,
+            TASK_RUNNING_NOTIFIED
+        };
+
+        class Task : public stream_listener {
+        public:
+            Task(task_scheduler* sched, generic_unnamed_block* block) : sched(sched), block(block) {}
+
+            void notify() {
+                sched->schedule(this);
+            }
+
+            task_scheduler* sched;
+            generic_unnamed_block* block;
+            std::vector<untyped_steam*> inputs;
+            std::vector<untyped_steam*> outputs;
+            std::atomic<int> state{TASK_IDLE};
+            std::atomic<bool> detached{false};
+
+            // run() returned -1, only touched by the worker running the task
+            bool ended = false;
+
+            // readerStarted() was called on the inputs, only touched by the worker running the task
+            bool started = false;
+
+            // Worker that last ran the task, -1 if none
+            std::atomic<int> home{-1};
+        };
+
+        // Queue a task whose state was just set to TASK_QUEUED. Must check detached under the
+        // same lock unqueue() takes and call setIdle() instead of queuing if it's set.
+        // requeue is true when the task is put back by the worker that just ran it.
+        virtual void push(Task* task, bool requeue) = 0;
+
+        // Remove a task from the queues, returns true if it was there
+        virtual bool unqueue(Task* task) = 0;
+
+        void schedule(Task* task) {
+            int s = task->state.load();
+            while (true) {
+                if (s == TASK_IDLE) {
+                    if (task->state.compare_exchange_weak(s, TASK_QUEUED)) {
+                        push(task, false);
+                        return;
+                    }
+                }
+                else if (s == TASK_RUNNING) {
+                    // Let the worker running it know it has to look again
+                    if (task->state.compare_exchange_weak(s, TASK_RUNNING_NOTIFIED)) { return; }
+                }
+                else {
+                    return;
+                }
+            }
+        }
+
+        void setIdle(Task* task) {
+            task->state.store(TASK_IDLE);
+            std::lock_guard<std::mutex> lck(doneMtx);
+            doneCV.notify_all();
+        }
+
+        bool isReady(Task* task) {
+            for (auto& in : task->inputs) {
+                if (!in->isReadable()) { return false; }
+            }
+            for (auto& out : task->outputs) {
+                if (!out->isWritable()) { return false; }
+            }
+            return true;
+        }
+
+        // Run a dequeued task, its state must have been set to TASK_RUNNING. Returns the number of run() calls.
+        int execute(Task* task) {
+            bool ready = false;
+            int runs = 0;
+            for (; runs < SCHEDULER_TASK_BATCH; runs++) {
+                ready = !task->detached && !task->ended && isReady(task);
+                if (!ready) { break; }
+
+                // Like a dedicated thread, the first worker to run the block places its input buffers
+                if (!task->started) {
+                    for (auto& in : task->inputs) { in->readerStarted(); }
+                    task->started = true;
+                }
+
+                if (task->block->timedRun() < 0) {
+                    task->ended = true;
+                    task->block->runEnded();
+                    ready = false;
+                    break;
+                }
+            }
+
+            // Go back to idle unless something changed while running or it's still got work to do
+            int s = TASK_RUNNING;
+            if (!ready && task->state.compare_exchange_strong(s, TASK_IDLE)) {
+                std::lock_guard<std::mutex> lck(doneMtx);
+                doneCV.notify_all();
+                return runs;
+            }
+            task->state.store(TASK_QUEUED);
+            push(task, true);
+            return runs;
+        }
+
+        static int defaultThreadCount() {
+            return std::max<int>(std::thread::hardware_concurrency(), 1);
+        }
+
+    private:
+        std::mutex tasksMtx;
+        std::map<generic_unnamed_block*, Task*> tasks;
+
+        std::mutex doneMtx;
+        std::condition_variable doneCV;
+
+    };
+
+    // Runs blocks on a fixed pool of worker threads sharing a single queue. Freshly woken blocks
+    // go to the front so a consumer runs while its input is still in cache, blocks put back after
+    // using up their batch go to the back so they don't starve the others.
+    class ThreadPoolScheduler : public task_scheduler {
+    public:
+        ThreadPoolScheduler() {}
+
+        ThreadPoolScheduler(int threadCount) { init(threadCount); }
+
+        ~ThreadPoolScheduler() {
+            stop();
+        }
+
+        // 0 threads means one per core
+        void init(int threadCount = 0) {
+            _threadCount = (threadCount > 0) ? threadCount : defaultThreadCount();
+        }
+
+        void start() {
+            if (running) { return; }
+            stopWorkers = false;
+            for (int i = 0; i < _threadCount; i++) {
+                workers.push_back(std::thread(&ThreadPoolScheduler::worker, this));
+            }
+            running = true;
+        }
+
+        void stop() {
+            if (!running) { return; }
+            {
+                std::lock_guard<std::mutex> lck(queueMtx);
+                stopWorkers = true;
+            }
+            queueCV.notify_all();
+            for (auto& w : workers) {
+                if (w.joinable()) { w.join(); }
+            }
+            workers.clear();
+            running = false;
+        }
+
+        int getThreadCount() {
+            return _threadCount;
+        }
+
+    private:
+        void push(Task* task, bool requeue) {
+            {
+                std::lock_guard<std::mutex> lck(queueMtx);
+                if (!task->detached) {
+                    if (requeue) {
+                        queue.push_back(task);
+                    }
+                    else {
+                        queue.push_front(task);
+                    }
+                    queueCV.notify_one();
+                    return;
+                }
+            }
+            setIdle(task);
+        }
+
+        bool unqueue(Task* task) {
+            std::lock_guard<std::mutex> lck(queueMtx);
+            auto it = std::find(queue.begin(), queue.end(), task);
+            if (it == queue.end()) { return false; }
+            queue.erase(it);
+            return true;
+        }
+
+        void worker() {
+            while (true) {
+                Task* task;
+                {
+                    std::unique_lock<std::mutex> lck(queueMtx);
+                    queueCV.wait(lck, [this]{ return !queue.empty() || stopWorkers; });
+                    if (stopWorkers) { return; }
+                    task = queue.front();
+                    queue.pop_front();
+                    task->state.store(TASK_RUNNING);
+                }
+                execute(task);
+            }
+        }
+
+        int _threadCount = 1;
+        bool running = false;
+        std::vector<std::thread> workers;
+
+        std::mutex queueMtx;
+        std::condition_variable queueCV;
+        std::deque<Task*> queue;
+        bool stopWorkers = false;
+
+    };
+
+    struct worker_stats {
+        uint64_t dispatches;    // Tasks taken off a queue
+        uint64_t runs;          // run() calls
+        uint64_t localPushes;   // Tasks queued by this worker for itself
+        uint64_t remotePushes;  // Tasks queued for this worker by another thread
+        uint64_t steals;        // Tasks this worker took from another worker's queue
+        uint64_t stolen;        // Tasks other workers took from this worker's queue
+        uint64_t sleeps;        // Times this worker ran out of work and parked
+        int queueSize;
+    };
+
+    // Runs blocks on a pool of workers that each own a queue. A block woken by a stream
+    // operation done on a worker is queued at the front of that worker's queue, so a consumer
+    // runs on the core that just filled its input while the buffer is still in cache. Blocks
+    // woken from elsewhere go back to the worker that last ran them. Idle workers steal from
+    // the back of the other queues.
+    class WorkStealingScheduler : public task_scheduler {
+    public:
+        WorkStealingScheduler() { init(); }
+
+        WorkStealingScheduler(int threadCount, bool pinThreads = false) { init(threadCount, pinThreads); }
+
+        ~WorkStealingScheduler() {
+            stop();
+        }
+
+        // 0 threads means one per core. pinThreads locks each worker to a core (Linux only).
+        // Must be called before any block is attached.
+        void init(int threadCount = 0, bool pinThreads = false) {
+            if (running) { return; }
+            _threadCount = (threadCount > 0) ? threadCount : defaultThreadCount();
+            _pinThreads = pinThreads;
+            workers.clear();
+            for (int i = 0; i < _threadCount; i++) {
+                workers.emplace_back(new Worker);
+            }
+        }
+
+        void start() {
+            if (running) { return; }
+            if (workers.empty()) { init(); }
+            stopWorkers = false;
+            for (int i = 0; i < _threadCount; i++) {
+                workers[i]->thread = std::thread(&WorkStealingScheduler::worker, this, i);
+            }
+            running = true;
+        }
+
+        void stop() {
+            if (!running) { return; }
+            {
+                std::lock_guard<std::mutex> lck(sleepMtx);
+                stopWorkers = true;
+            }
+            for (auto& w : workers) {
+                w->cv.notify_all();
+            }
+            for (auto& w : workers) {
+                if (w->thread.joinable()) { w->thread.join(); }
+            }
+            running = false;
+        }
+
+        int getThreadCount() {
+            return _threadCount;
+        }
+
+        worker_stats getWorkerStats(int id) {
+            Worker* w = workers[id].get();
+            worker_stats stats;
+            stats.dispatches = w->dispatches.load(std::memory_order_relaxed);
+            stats.runs = w->runs.load(std::memory_order_relaxed);
+            stats.localPushes = w->localPushes.load(std::memory_order_relaxed);
+            stats.remotePushes = w->remotePushes.load(std::memory_order_relaxed);
+            stats.steals = w->steals.load(std::memory_order_relaxed);
+            stats.stolen = w->stolen.load(std::memory_order_relaxed);
+            stats.sleeps = w->sleeps.load(std::memory_order_relaxed);
+            stats.queueSize = w->size.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        std::vector<worker_stats> getWorkerStats() {
+            std::vector<worker_stats> stats;
+            for (int i = 0; i < _threadCount; i++) {
+                stats.push_back(getWorkerStats(i));
+            }
+            return stats;
+        }
+
+    private:
+        struct Worker {
+            std::mutex mtx;
+            std::deque<Task*> queue;
+            std::atomic<int> size{0};
+
+            // Protected by sleepMtx
+            std::condition_variable cv;
+            bool sleeping = false;
+            bool woken = false;
+
+            std::thread thread;
+
+            std::atomic<uint64_t> dispatches{0};
+            std::atomic<uint64_t> runs{0};
+            std::atomic<uint64_t> localPushes{0};
+            std::atomic<uint64_t> remotePushes{0};
+            std::atomic<uint64_t> steals{0};
+            std::atomic<uint64_t> stolen{0};
+            std::atomic<uint64_t> sleeps{0};
+        };
+
+        void push(Task* task, bool requeue) {
+            bool local = (currentSched == this);
+            int id = local ? currentWorker : task->home.load(std::memory_order_relaxed);
+            if (id < 0) { id = nextWorker.fetch_add(1, std::memory_order_relaxed) % _threadCount; }
+            Worker* w = workers[id].get();
+
+            int size;
+            {
+                std::unique_lock<std::mutex> lck(w->mtx);
+                if (task->detached) {
+                    // Checked under the lock so that unqueue() can't miss it
+                    lck.unlock();
+                    setIdle(task);
+                    return;
+                }
+
+                // Consumers woken by this worker run next on it, anything else waits its turn
+                if (local && !requeue) {
+                    w->queue.push_front(task);
+                }
+                else {
+                    w->queue.push_back(task);
+                }
+                size = w->size.fetch_add(1, std::memory_order_seq_cst) + 1;
+            }
+            (local ? w->localPushes : w->remotePushes).fetch_add(1, std::memory_order_relaxed);
+
+            // Wake the owner if it's parked. If it's busy and has a backlog, wake someone else to steal
+            if (sleepers.load(std::memory_order_seq_cst) == 0) { return; }
+            std::lock_guard<std::mutex> lck(sleepMtx);
+            if (w->sleeping) {
+                w->cv.notify_one();
+                return;
+            }
+            if (size <= 1) { return; }
+            for (auto& other : workers) {
+                if (!other->sleeping || other->woken) { continue; }
+                other->woken = true;
+                other->cv.notify_one();
+                return;
+            }
+        }
+
+        bool unqueue(Task* task) {
+            for (auto& w : workers) {
+                std::lock_guard<std::mutex> lck(w->mtx);
+                auto it = std::find(w->queue.begin(), w->queue.end(), task);
+                if (it == w->queue.end()) { continue; }
+                w->queue.erase(it);
+                w->size.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        Task* popLocal(int id) {
+            Worker* w = workers[id].get();
+            std::lock_guard<std::mutex> lck(w->mtx);
+            if (w->queue.empty()) { return NULL; }
+            Task* task = w->queue.front();
+            w->queue.pop_front();
+            w->size.fetch_sub(1, std::memory_order_relaxed);
+            task->state.store(TASK_RUNNING);
+            return task;
+        }
+
+        Task* steal(int id) {
+            // Start with the next worker so that victims are spread out
+            for (int i = 1; i < _threadCount; i++) {
+                Worker* victim = workers[(id + i) % _threadCount].get();
+                if (victim->size.load(std::memory_order_relaxed) == 0) { continue; }
+                std::lock_guard<std::mutex> lck(victim->mtx);
+                if (victim->queue.empty()) { continue; }
+                Task* task = victim->queue.back();
+                victim->queue.pop_back();
+                victim->size.fetch_sub(1, std::memory_order_relaxed);
+                victim->stolen.fetch_add(1, std::memory_order_relaxed);
+                workers[id]->steals.fetch_add(1, std::memory_order_relaxed);
+                task->state.store(TASK_RUNNING);
+                return task;
+            }
+            return NULL;
+        }
+
+        void pin(int id) {
+#if defined(__linux__)
+            int cores = std::thread::hardware_concurrency();
+            if (cores <= 0) { return; }
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(id % cores, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+#endif
+        }
+
+        void worker(int id) {
+            currentSched = this;
+            currentWorker = id;
+            if (_pinThreads) { pin(id); }
+            Worker* w = workers[id].get();
+
+            while (true) {
+                Task* task = popLocal(id);
+                if (!task) { task = steal(id); }
+                if (task) {
+                    task->home.store(id, std::memory_order_relaxed);
+                    w->dispatches.fetch_add(1, std::memory_order_relaxed);
+                    w->runs.fetch_add(execute(task), std::memory_order_relaxed);
+                    continue;
+                }
+
+                // Nothing to do, park until something is queued here or another worker needs a thief
+                std::unique_lock<std::mutex> lck(sleepMtx);
+                w->sleeping = true;
+                sleepers.fetch_add(1, std::memory_order_seq_cst);
+                w->sleeps.fetch_add(1, std::memory_order_relaxed);
+                w->cv.wait(lck, [this, w]{ return w->size.load(std::memory_order_seq_cst) > 0 || w->woken || stopWorkers; });
+                sleepers.fetch_sub(1, std::memory_order_seq_cst);
+                w->sleeping = false;
+                w->woken = false;
+                if (stopWorkers) { return; }
+            }
+        }
+
+        int _threadCount = 0;
+        bool _pinThreads = false;
+        bool running = false;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<int> nextWorker{0};
+
+        std::mutex sleepMtx;
+        std::atomic<int> sleepers{0};
+        bool stopWorkers = false;
+
+        static inline thread_local WorkStealingScheduler* currentSched = NULL;
+        static inline thread_local int currentWorker = -1;
+
+    };
+}
@@ -86,7 +86,10 @@ namespace dsp {
         void doStop() {
             _in->stopReader();
             data.stopWriter();
-            if (generic_block<RingBufferSink<T>>::workerThread.joinable()) {
+            if (generic_block<RingBufferSink<T>>::_sched) {
+                generic_block<RingBufferSink<T>>::_sched->detach(this);
+            }
+            else if (generic_block<RingBufferSink<T>>::workerThread.joinable()) {
                 generic_block<RingBufferSink<T>>::workerThread.join();
             }
             _in->clearReadStop();
@@ -174,6 +177,10 @@ namespace dsp {
         }
 
     private:
+        void finish() {
+            if (file.is_open()) { file.flush(); }
+        }
+
         stream<T>* _in;
         std::ofstream file;
 
@@ -8,23 +8,29 @@ namespace dsp {
 
         SineSource(int blockSize, float sampleRate, float freq) { init(blockSize, sampleRate, freq); }
 
+        ~SineSource() {
+            generic_block<SineSource>::stop();
+            buffer::free(zeroPhase);
+        }
+
         void init(int blockSize, float sampleRate, float freq) {
             _blockSize = blockSize;
             _sampleRate = sampleRate;
             _freq = freq;
-            zeroPhase = (lv_32fc_t*)volk_malloc(STREAM_BUFFER_SIZE * sizeof(lv_32fc_t), volk_get_alignment());
-            for (int i = 0; i < STREAM_BUFFER_SIZE; i++) {
-                zeroPhase[i] = lv_cmake(1.0f, 0.0f);
-            }
+            allocZeroPhase();
+            out.setBufferSize(_blockSize);
             phase = lv_cmake(1.0f, 0.0f);
             phaseDelta = lv_cmake(std::cos((_freq / _sampleRate) * 2.0f * FL_M_PI), std::sin((_freq / _sampleRate) * 2.0f * FL_M_PI));
             generic_block<SineSource>::registerOutput(&out);
         }
 
+        // Can't grow past the block size given to init(), the output stream is sized for it
         void setBlockSize(int blockSize) {
             std::lock_guard<std::mutex> lck(generic_block<SineSource>::ctrlMtx);
             generic_block<SineSource>::tempStop();
-            _blockSize = blockSize;
+            _blockSize = std::min<int>(blockSize, out.getBufferSize());
+            buffer::free(zeroPhase);
+            allocZeroPhase();
             generic_block<SineSource>::tempStart();
         }
 
@@ -61,6 +67,13 @@ namespace dsp {
         stream<complex_t> out;
 
     private:
+        void allocZeroPhase() {
+            zeroPhase = buffer::alloc<lv_32fc_t>(_blockSize);
+            for (int i = 0; i < _blockSize; i++) {
+                zeroPhase[i] = lv_cmake(1.0f, 0.0f);
+            }
+        }
+
         int _blockSize;
         float _sampleRate;
         float _freq;
@@ -1,12 +1,83 @@
 #pragma once
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <chrono>
+#include <string.h>
 #include <volk/volk.h>
+#include <dsp/utils/event.h>
+#include <dsp/utils/allocator.h>
+#include <dsp/utils/trace.h>
 
 // 1MB buffer
 #define STREAM_BUFFER_SIZE  1000000
 
+// Number of buffers in a stream's ring, 2 is plain double buffering
+#define STREAM_DEFAULT_DEPTH    2
+
 namespace dsp {
+    // What swap() does when the reader is behind and no buffer is free
+    enum overflow_policy {
+        STREAM_BLOCK,           // Wait for the reader
+        STREAM_DROP_NEWEST,     // Discard the buffer being swapped
+        STREAM_DROP_OLDEST      // Discard the oldest unread buffer (or the newest if the reader is busy with it)
+    };
+
+    // Well known tag keys, applications can use their own from TAG_USER on
+    enum tag_key {
+        TAG_TIMESTAMP,          // Time of the item, in seconds
+        TAG_FREQUENCY,          // Center frequency from that item on, in Hz
+        TAG_SAMPLE_RATE,        // Sample rate from that item on, in Hz
+        TAG_USER = 1000
+    };
+
+    // Metadata attached to a single item of a stream
+    struct stream_tag {
+        uint64_t offset;        // Absolute index of the item since the stream was created
+        int key;
+        double value;
+    };
+
+    struct stream_stats {
+        uint64_t writtenItems;  // Items published by the writer
+        uint64_t readItems;     // Items flushed by the reader
+        uint64_t writerWaitNs;  // Time the writer spent waiting for a free buffer
+        uint64_t readerWaitNs;  // Time the reader spent waiting for data
+        uint64_t droppedItems;  // Items discarded by the overflow policy
+        uint64_t droppedBuffers;
+        uint64_t writerWakes;   // Waits of the writer that ended
+        uint64_t writerWakeNs;  // Time between the notification ending each of those waits and the writer running again
+        uint64_t readerWakes;
+        uint64_t readerWakeNs;
+    };
+
+    // Wait strategy new streams start with
+    inline std::atomic<int>& defaultWaitStrategy() {
+        static std::atomic<int> strategy{WAIT_BLOCK};
+        return strategy;
+    }
+
+    inline std::atomic<int>& defaultSpinBudget() {
+        static std::atomic<int> budget{EVENT_SPIN_COUNT};
+        return budget;
+    }
+
+    // Set the wait strategy of all streams created from then on, see stream::setWaitStrategy()
+    inline void setDefaultWaitStrategy(wait_strategy strategy, int spinBudget = EVENT_SPIN_COUNT) {
+        defaultWaitStrategy().store(strategy, std::memory_order_relaxed);
+        defaultSpinBudget().store(spinBudget, std::memory_order_relaxed);
+    }
+
+    // Notified when a stream changes state, schedulers use it to find blocks that are ready to run
+    class stream_listener {
+    public:
+        virtual ~stream_listener() {}
+        virtual void notify() = 0;
+    };
+
     class untyped_steam {
     public:
         virtual bool swap(int size) { return false; }
@@ -16,111 +87,434 @@ namespace dsp {
         virtual void clearWriteStop() {}
         virtual void stopReader() {}
         virtual void clearReadStop() {}
+        virtual int getBufferSize() { return 0; }
+        virtual void sendEOS() {}
+        virtual bool isEOS() { return false; }
+        virtual void clearEOS() {}
+
+        // Called from the reader's thread before it starts reading
+        virtual void readerStarted() {}
+
+        // True if read() wouldn't block
+        virtual bool isReadable() { return true; }
+
+        // True if swap() wouldn't block
+        virtual bool isWritable() { return true; }
+
+        void setReaderListener(stream_listener* listener) {
+            readerListener.store(listener, std::memory_order_release);
+        }
+
+        void setWriterListener(stream_listener* listener) {
+            writerListener.store(listener, std::memory_order_release);
+        }
+
+        stream_stats getStats() {
+            stream_stats stats;
+            stats.writtenItems = writtenItems.load(std::memory_order_relaxed);
+            stats.readItems = readItems.load(std::memory_order_relaxed);
+            stats.writerWaitNs = writerWaitNs.load(std::memory_order_relaxed);
+            stats.readerWaitNs = readerWaitNs.load(std::memory_order_relaxed);
+            stats.droppedItems = droppedItems.load(std::memory_order_relaxed);
+            stats.droppedBuffers = droppedBuffers.load(std::memory_order_relaxed);
+            stats.writerWakes = writerWakes.load(std::memory_order_relaxed);
+            stats.writerWakeNs = writerWakeNs.load(std::memory_order_relaxed);
+            stats.readerWakes = readerWakes.load(std::memory_order_relaxed);
+            stats.readerWakeNs = readerWakeNs.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+    protected:
+        // Each counter only has a single writing thread so no need for an atomic add
+        static void addCount(std::atomic<uint64_t>& counter, uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        // The wakeup latency is counted from the notification that ended the wait, or from its start if it was missed
+        void addWait(std::atomic<uint64_t>& waitNs, std::atomic<uint64_t>& wakes, std::atomic<uint64_t>& wakeNs, event& ev, const char* traceName, std::chrono::steady_clock::time_point start) {
+            auto end = std::chrono::steady_clock::now();
+            auto notified = std::clamp(ev.lastNotify(), start, end);
+            addCount(waitNs, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            addCount(wakes, 1);
+            addCount(wakeNs, std::chrono::duration_cast<std::chrono::nanoseconds>(end - notified).count());
+            if (trace::isEnabled()) { trace::record(traceName, this, start, end); }
+        }
+
+        void notifyReader() {
+            stream_listener* listener = readerListener.load(std::memory_order_acquire);
+            if (listener) { listener->notify(); }
+        }
+
+        void notifyWriter() {
+            stream_listener* listener = writerListener.load(std::memory_order_acquire);
+            if (listener) { listener->notify(); }
+        }
+
+        std::atomic<stream_listener*> readerListener{NULL};
+        std::atomic<stream_listener*> writerListener{NULL};
+
+        alignas(64) std::atomic<uint64_t> writtenItems{0};
+        std::atomic<uint64_t> writerWaitNs{0};
+        std::atomic<uint64_t> droppedItems{0};
+        std::atomic<uint64_t> droppedBuffers{0};
+        std::atomic<uint64_t> writerWakes{0};
+        std::atomic<uint64_t> writerWakeNs{0};
+        alignas(64) std::atomic<uint64_t> readItems{0};
+        std::atomic<uint64_t> readerWaitNs{0};
+        std::atomic<uint64_t> readerWakes{0};
+        std::atomic<uint64_t> readerWakeNs{0};
+
+    };
+
+    // Buffer lent to a stream by another owner, released once the reader has flushed it
+    class buffer_ref {
+    public:
+        virtual ~buffer_ref() {}
+        virtual void release() = 0;
     };
 
     template <class T>
     class stream : public untyped_steam {
     public:
-        stream() {
-            writeBuf = (T*)volk_malloc(STREAM_BUFFER_SIZE * sizeof(T), volk_get_alignment());
-            readBuf = (T*)volk_malloc(STREAM_BUFFER_SIZE * sizeof(T), volk_get_alignment());
+        stream(int depth = STREAM_DEFAULT_DEPTH, int bufferSize = STREAM_BUFFER_SIZE) {
+            _bufferSize = bufferSize;
+            allocBuffers(depth);
+            setWaitStrategy((wait_strategy)defaultWaitStrategy().load(std::memory_order_relaxed), defaultSpinBudget().load(std::memory_order_relaxed));
         }
 
         ~stream() {
-            volk_free(writeBuf);
-            volk_free(readBuf);
+            freeBuffers();
+        }
+
+        // Must only be called while neither the reader nor the writer are running
+        void setDepth(int depth) {
+            freeBuffers();
+            allocBuffers(depth);
+        }
+
+        int getDepth() {
+            return _depth;
+        }
+
+        // Must only be called while neither the reader nor the writer are running
+        void setBufferSize(int bufferSize) {
+            freeBuffers();
+            _bufferSize = bufferSize;
+            allocBuffers(_depth);
+        }
+
+        // Maximum number of items a single swap can carry
+        int getBufferSize() {
+            return _bufferSize;
+        }
+
+        // Must only be called while neither the reader nor the writer are running
+        void setOverflowPolicy(overflow_policy policy) {
+            _policy = policy;
+        }
+
+        overflow_policy getOverflowPolicy() {
+            return _policy;
+        }
+
+        // How the reader and writer wait for each other. WAIT_SPIN trades a busy core for the
+        // latency of parking and waking a thread on every hop, WAIT_SPIN_PARK spins for
+        // spinBudget iterations first. Must only be called while neither the reader nor the
+        // writer are running.
+        void setWaitStrategy(wait_strategy strategy, int spinBudget = EVENT_SPIN_COUNT) {
+            rdyEvent.setStrategy(strategy, spinBudget);
+            swapEvent.setStrategy(strategy, spinBudget);
         }
 
         bool swap(int size) {
-            {
-                // Wait to either swap or stop
-                std::unique_lock<std::mutex> lck(swapMtx);
-                swapCV.wait(lck, [this]{ return (canSwap || writerStop); });
-
-                // If writer was stopped, abandon operation
-                if (writerStop) { return false; }
-
-                // Swap buffers
-                dataSize = size;
-                T* temp = writeBuf;
-                writeBuf = readBuf;
-                readBuf = temp;
-                canSwap = false;
-            }
+            return publish(size, NULL, NULL);
+        }
 
-            // Notify reader that some data is ready
-            {
-                std::lock_guard<std::mutex> lck(rdyMtx);
-                dataReady = true;
+        // Publish a buffer owned by someone else instead of writeBuf. The reader gets it
+        // as its readBuf and ref is released once the reader flushes it.
+        bool swapShared(T* data, int size, buffer_ref* ref) {
+            return publish(size, data, ref);
+        }
+
+        int read() {
+            uint64_t t;
+            while (true) {
+                // Wait for data to be ready or to be stopped
+                t = tail.load(std::memory_order_acquire) >> 1;
+                auto ready = [this, t]{ return (head.load(std::memory_order_acquire) > t || readerStop.load(std::memory_order_acquire) || eos.load(std::memory_order_acquire)); };
+                if (!ready()) {
+                    auto start = std::chrono::steady_clock::now();
+                    rdyEvent.wait(ready);
+                    addWait(readerWaitNs, readerWakes, readerWakeNs, rdyEvent, "read wait", start);
+                }
+
+                if (readerStop.load(std::memory_order_acquire)) { return -1; }
+
+                // Everything published before the end of stream still gets read
+                if (head.load(std::memory_order_acquire) <= t) { return -1; }
+
+                // When the writer may drop the oldest buffer, mark it as being read first. If it
+                // was dropped in the meantime, try again with the next one.
+                if (_policy != STREAM_DROP_OLDEST) { break; }
+                uint64_t expected = t << 1;
+                if (tail.compare_exchange_strong(expected, (t << 1) | TAIL_HELD, std::memory_order_acq_rel)) { break; }
             }
-            rdyCV.notify_all();
 
-            return true;
+            int slot = t % _depth;
+            readBuf = refs[slot] ? shared[slot] : buffers[slot];
+            return sizes[slot];
         }
 
-        int read() {
-            // Wait for data to be ready or to be stopped
-            std::unique_lock<std::mutex> lck(rdyMtx);
-            rdyCV.wait(lck, [this]{ return (dataReady || readerStop); });
+        // Hand a buffer of getBufferSize() items to the stream in place of the one
+        // currently being read and take ownership of the latter. Must be called between
+        // read() and flush().
+        T* exchangeReadBuf(T* buf) {
+            int slot = (tail.load(std::memory_order_relaxed) >> 1) % _depth;
+            T* old = buffers[slot];
 
-            return (readerStop ? -1 : dataSize);
+            // A lent buffer can't be given away, its data goes out in the slot's own one instead
+            if (refs[slot]) { memcpy(old, shared[slot], sizes[slot] * sizeof(T)); }
+
+            buffers[slot] = buf;
+            readBuf = buf;
+            return old;
         }
 
         void flush() {
-            // Clear data ready
-            {
-                std::lock_guard<std::mutex> lck(rdyMtx);
-                dataReady = false;
+            // Release the oldest buffer, if there is one
+            uint64_t ts = tail.load(std::memory_order_acquire);
+            uint64_t t = ts >> 1;
+            if (t >= head.load(std::memory_order_acquire)) { return; }
+
+            // If the buffer wasn't marked by read(), mark it now so the writer can't drop it while it's
+            // being released. If it's already been dropped, there's nothing left to do.
+            if (_policy == STREAM_DROP_OLDEST && !(ts & TAIL_HELD)) {
+                if (!tail.compare_exchange_strong(ts, ts | TAIL_HELD, std::memory_order_acq_rel)) { return; }
             }
 
-            // Notify writer that buffers can be swapped
-            {
-                std::lock_guard<std::mutex> lck(swapMtx);
-                canSwap = true;
+            int slot = t % _depth;
+            addCount(readItems, sizes[slot]);
+            if (refs[slot]) {
+                refs[slot]->release();
+                refs[slot] = NULL;
             }
+            if (!tags[slot].empty()) { tags[slot].clear(); }
+            tail.store((t + 1) << 1, std::memory_order_release);
 
-            swapCV.notify_all();
+            // Notify writer that a buffer is free
+            swapEvent.notify();
+            notifyWriter();
         }
 
-        void stopWriter() {
-            {
-                std::lock_guard<std::mutex> lck(swapMtx);
-                writerStop = true;
+        // Attach a tag to writeBuf[index], must be called before the buffer is swapped.
+        // Tags of a buffer must be added in increasing index order.
+        void addTag(int index, int key, double value) {
+            tags[head.load(std::memory_order_relaxed) % _depth].push_back({ writeOffset + index, key, value });
+        }
+
+        // Lets the allocator move the buffers closer to the reader
+        void readerStarted() {
+            for (auto& buf : buffers) {
+                buffer::readerStarted(buf);
             }
-            swapCV.notify_all();
+        }
+
+        // Absolute offset of writeBuf[0]
+        uint64_t getWriteOffset() {
+            return writeOffset;
+        }
+
+        // Tags of readBuf sorted by offset, valid between read() and flush()
+        const std::vector<stream_tag>& getReadTags() {
+            return tags[(tail.load(std::memory_order_relaxed) >> 1) % _depth];
+        }
+
+        // Absolute offset of readBuf[0], valid between read() and flush()
+        uint64_t getReadOffset() {
+            return offsets[(tail.load(std::memory_order_relaxed) >> 1) % _depth];
+        }
+
+        bool isReadable() {
+            return (head.load(std::memory_order_acquire) > (tail.load(std::memory_order_relaxed) >> 1) || readerStop.load(std::memory_order_acquire) || eos.load(std::memory_order_acquire));
+        }
+
+        bool isWritable() {
+            return (_policy != STREAM_BLOCK || hasRoom(head.load(std::memory_order_relaxed)) || writerStop.load(std::memory_order_acquire));
+        }
+
+        void stopWriter() {
+            writerStop.store(true, std::memory_order_release);
+            swapEvent.notify();
+            notifyWriter();
         }
 
         void clearWriteStop() {
-            writerStop = false;
+            writerStop.store(false, std::memory_order_release);
         }
 
         void stopReader() {
-            {
-                std::lock_guard<std::mutex> lck(rdyMtx);
-                readerStop = true;
-            }
-            rdyCV.notify_all();
+            readerStop.store(true, std::memory_order_release);
+            rdyEvent.notify();
+            notifyReader();
         }
 
         void clearReadStop() {
-            readerStop = false;
+            readerStop.store(false, std::memory_order_release);
+        }
+
+        // Called by the writer after its last swap. Once the reader has read everything
+        // published before it, read() returns -1 and isEOS() returns true.
+        void sendEOS() {
+            eos.store(true, std::memory_order_release);
+            rdyEvent.notify();
+            notifyReader();
+        }
+
+        // True once the writer has ended the stream and everything has been read
+        bool isEOS() {
+            return (eos.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) <= (tail.load(std::memory_order_relaxed) >> 1));
+        }
+
+        // Called by the writer before it starts producing again
+        void clearEOS() {
+            eos.store(false, std::memory_order_release);
         }
 
         T* writeBuf;
         T* readBuf;
 
     private:
-        std::mutex swapMtx;
-        std::condition_variable swapCV;
-        bool canSwap = true;
+        // True if a buffer is free past the one being published
+        bool hasRoom(uint64_t h) {
+            return ((h - (tail.load(std::memory_order_acquire) >> 1)) < (uint64_t)(_depth - 1));
+        }
+
+        bool publish(int size, T* data, buffer_ref* ref) {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            if (_policy == STREAM_BLOCK) {
+                // Wait until a buffer is free past the one being published, or to be stopped
+                auto room = [this, h]{ return (hasRoom(h) || writerStop.load(std::memory_order_acquire)); };
+                if (!room()) {
+                    auto start = std::chrono::steady_clock::now();
+                    swapEvent.wait(room);
+                    addWait(writerWaitNs, writerWakes, writerWakeNs, swapEvent, "swap wait", start);
+                }
+            }
+
+            // If writer was stopped, abandon operation
+            if (writerStop.load(std::memory_order_acquire)) { return false; }
+
+            // Make room by dropping a buffer if the policy allows it. The new one goes if the old one can't.
+            if (_policy != STREAM_BLOCK && !hasRoom(h)) {
+                if (_policy != STREAM_DROP_OLDEST || !dropOldest()) {
+                    addCount(droppedItems, size);
+                    addCount(droppedBuffers, 1);
+                    if (ref) { ref->release(); }
+                    if (!tags[h % _depth].empty()) { tags[h % _depth].clear(); }
+                    writeOffset += size;
+                    return true;
+                }
+            }
+
+            // Publish the buffer and move on to the next free one
+            int slot = h % _depth;
+            sizes[slot] = size;
+            shared[slot] = data;
+            refs[slot] = ref;
+            offsets[slot] = writeOffset;
+            writeOffset += size;
+            addCount(writtenItems, size);
+            writeBuf = buffers[(h + 1) % _depth];
+            head.store(h + 1, std::memory_order_release);
+
+            // Notify reader that some data is ready
+            rdyEvent.notify();
+            notifyReader();
+
+            return true;
+        }
+
+        // Discard the oldest unread buffer unless the reader has started reading it
+        bool dropOldest() {
+            uint64_t ts = tail.load(std::memory_order_acquire);
+            if (ts & TAIL_HELD) { return false; }
+            uint64_t t = ts >> 1;
+            int slot = t % _depth;
+            int size = sizes[slot];
+            buffer_ref* ref = refs[slot];
+            if (!tail.compare_exchange_strong(ts, (t + 1) << 1, std::memory_order_acq_rel)) { return false; }
+            addCount(droppedItems, size);
+            addCount(droppedBuffers, 1);
+            if (ref) {
+                refs[slot] = NULL;
+                ref->release();
+            }
+            if (!tags[slot].empty()) { tags[slot].clear(); }
+            return true;
+        }
+
+        void allocBuffers(int depth) {
+            _depth = std::max<int>(depth, 2);
+            buffers.resize(_depth);
+            sizes.resize(_depth);
+            shared.resize(_depth);
+            refs.resize(_depth);
+            offsets.resize(_depth);
+            tags.resize(_depth);
+            for (int i = 0; i < _depth; i++) {
+                buffers[i] = buffer::alloc<T>(_bufferSize);
+                sizes[i] = 0;
+                shared[i] = NULL;
+                refs[i] = NULL;
+                offsets[i] = 0;
+                tags[i].clear();
+            }
+            writeOffset = 0;
+            head.store(0);
+            tail.store(0);
+            writeBuf = buffers[0];
+            readBuf = buffers[_depth - 1];
+        }
+
+        void freeBuffers() {
+            for (auto& buf : buffers) {
+                buffer::free(buf);
+            }
+            buffers.clear();
+
+            // Give back any lent buffer that was never read
+            for (auto& ref : refs) {
+                if (ref) { ref->release(); }
+            }
+            refs.clear();
+        }
+
+        // Ring of buffers, the writer fills buffers[head % depth] and the reader
+        // consumes buffers[(tail >> 1) % depth]. Single producer / single consumer, no locks.
+        // The low bit of tail is set while the reader holds a buffer the writer could drop.
+        static const uint64_t TAIL_HELD = 1;
+        overflow_policy _policy = STREAM_BLOCK;
+        int _depth;
+        int _bufferSize;
+        std::vector<T*> buffers;
+        std::vector<int> sizes;
+        std::vector<T*> shared;
+        std::vector<buffer_ref*> refs;
+
+        // Sparse tags of each buffer, they travel with it through the ring. The vectors
+        // keep their capacity so tagging doesn't allocate once warmed up.
+        std::vector<uint64_t> offsets;
+        std::vector<std::vector<stream_tag>> tags;
+        uint64_t writeOffset = 0;
 
-        std::mutex rdyMtx;
-        std::condition_variable rdyCV;
-        bool dataReady = false;
+        alignas(64) std::atomic<uint64_t> head{0};
+        event rdyEvent;
+        std::atomic<bool> readerStop{false};
+        std::atomic<bool> eos{false};
 
-        bool readerStop = false;
-        bool writerStop = false;
+        alignas(64) std::atomic<uint64_t> tail{0};
+        event swapEvent;
+        std::atomic<bool> writerStop{false};
 
-        int dataSize = 0;
     };
-}
\ No newline at end of file
+}
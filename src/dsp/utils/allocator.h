@@ -0,0 +1,189 @@
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <volk/volk.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+// Bytes reserved in front of every buffer to remember where it came from, keeps the data 64 byte aligned
+#define BUFFER_HEADER_SIZE  64
+
+#define HUGE_PAGE_SIZE      (2 * 1024 * 1024)
+
+// Let the kernel place pages on the node of the thread touching them first
+#define NUMA_NODE_LOCAL     -1
+
+namespace dsp {
+    // Source of the memory behind stream buffers and the large work buffers of blocks.
+    // An allocator must outlive every buffer it handed out.
+    class buffer_allocator {
+    public:
+        // Must return memory aligned on at least 64 bytes, or NULL
+        virtual void* allocate(size_t size) = 0;
+        virtual void deallocate(void* ptr, size_t size) = 0;
+
+        // Called from the thread that is about to read from the buffer
+        virtual void readerStarted(void* ptr, size_t size) {}
+    };
+
+    class volk_allocator : public buffer_allocator {
+    public:
+        void* allocate(size_t size) {
+            return volk_malloc(size, std::max<size_t>(volk_get_alignment(), 64));
+        }
+
+        void deallocate(void* ptr, size_t size) {
+            volk_free(ptr);
+        }
+    };
+
+    enum page_alloc_flags {
+        ALLOC_HUGE_PAGES    = (1 << 0),     // Back buffers with transparent 2MB pages
+        ALLOC_HUGETLB       = (1 << 1),     // Use reserved 2MB pages, falling back to transparent ones if none are left
+        ALLOC_PREFAULT      = (1 << 2),     // Touch every page up front so none faults while running
+        ALLOC_LOCK          = (1 << 3),     // Lock the pages in RAM
+        ALLOC_READER_NODE   = (1 << 4)      // Move stream buffers to the NUMA node of their reader when it starts
+    };
+
+    // Maps buffers straight from the kernel so that their pages can be tuned. Without
+    // ALLOC_PREFAULT and with NUMA_NODE_LOCAL, pages land on the node of the first thread
+    // writing to them. Falls back to volk on other platforms.
+    //
+    // Example:
+    //     static dsp::page_allocator alloc(dsp::ALLOC_HUGE_PAGES | dsp::ALLOC_PREFAULT | dsp::ALLOC_LOCK, 0);
+    //     dsp::buffer::setAllocator(&alloc);
+    class page_allocator : public buffer_allocator {
+    public:
+        page_allocator(int flags = 0, int node = NUMA_NODE_LOCAL) : _flags(flags), _node(node) {}
+
+#if defined(__linux__)
+        void* allocate(size_t size) {
+            size_t len = mapSize(size);
+            void* ptr = MAP_FAILED;
+            if (_flags & ALLOC_HUGETLB) {
+                ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            }
+            if (ptr == MAP_FAILED) {
+                ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (ptr == MAP_FAILED) { return NULL; }
+                if (_flags & (ALLOC_HUGE_PAGES | ALLOC_HUGETLB)) { madvise(ptr, len, MADV_HUGEPAGE); }
+            }
+
+            // The policy has to be set before the pages are touched
+            if (_node >= 0) { bindToNode(ptr, len, _node, 0); }
+            if (_flags & ALLOC_PREFAULT) { memset(ptr, 0, len); }
+            if (_flags & ALLOC_LOCK) { mlock(ptr, len); }
+            return ptr;
+        }
+
+        void deallocate(void* ptr, size_t size) {
+            munmap(ptr, mapSize(size));
+        }
+
+        void readerStarted(void* ptr, size_t size) {
+            if (!(_flags & ALLOC_READER_NODE)) { return; }
+            int node = currentNode();
+            if (node >= 0) { bindToNode(ptr, mapSize(size), node, MPOL_MF_MOVE); }
+        }
+
+        // NUMA node of the CPU the calling thread runs on, -1 if unknown
+        static int currentNode() {
+            unsigned int cpu, node;
+            if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0) { return -1; }
+            return node;
+        }
+
+    private:
+        size_t mapSize(size_t size) {
+            size_t page = (_flags & (ALLOC_HUGE_PAGES | ALLOC_HUGETLB)) ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+            return ((size + page - 1) / page) * page;
+        }
+
+        // Straight syscall to avoid depending on libnuma
+        static void bindToNode(void* ptr, size_t len, int node, unsigned int flags) {
+            if (node >= 64) { return; }
+            unsigned long mask = 1UL << node;
+            syscall(SYS_mbind, ptr, len, MPOL_PREFERRED, &mask, (sizeof(mask) * 8) + 1, flags);
+        }
+#else
+        void* allocate(size_t size) {
+            return volk_malloc(size, std::max<size_t>(volk_get_alignment(), 64));
+        }
+
+        void deallocate(void* ptr, size_t size) {
+            volk_free(ptr);
+        }
+
+        static int currentNode() {
+            return -1;
+        }
+#endif
+
+    private:
+        int _flags;
+        int _node;
+
+    };
+
+    namespace buffer {
+        struct header {
+            buffer_allocator* owner;
+            size_t size;
+        };
+
+        static_assert(sizeof(header) <= BUFFER_HEADER_SIZE);
+
+        inline std::atomic<buffer_allocator*>& current() {
+            static volk_allocator volkAlloc;
+            static std::atomic<buffer_allocator*> alloc{&volkAlloc};
+            return alloc;
+        }
+
+        inline buffer_allocator* getAllocator() {
+            return current().load(std::memory_order_acquire);
+        }
+
+        // Only affects buffers allocated from then on, existing ones still get freed by their own allocator
+        inline void setAllocator(buffer_allocator* alloc) {
+            current().store(alloc, std::memory_order_release);
+        }
+
+        inline header* getHeader(void* ptr) {
+            return (header*)((uint8_t*)ptr - BUFFER_HEADER_SIZE);
+        }
+
+        // Uninitialized buffer of count items, to be freed with buffer::free()
+        template <class T>
+        T* alloc(size_t count) {
+            buffer_allocator* owner = getAllocator();
+            size_t size = (count * sizeof(T)) + BUFFER_HEADER_SIZE;
+            uint8_t* base = (uint8_t*)owner->allocate(size);
+            if (!base) { return NULL; }
+            header* hdr = (header*)base;
+            hdr->owner = owner;
+            hdr->size = size;
+            return (T*)(base + BUFFER_HEADER_SIZE);
+        }
+
+        inline void free(void* ptr) {
+            if (!ptr) { return; }
+            header* hdr = getHeader(ptr);
+            hdr->owner->deallocate(hdr, hdr->size);
+        }
+
+        // Let the buffer's allocator know which thread reads from it
+        inline void readerStarted(void* ptr) {
+            if (!ptr) { return; }
+            header* hdr = getHeader(ptr);
+            hdr->owner->readerStarted(hdr, hdr->size);
+        }
+    }
+}
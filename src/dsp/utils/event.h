@@ -0,0 +1,138 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <limits.h>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define DSP_CPU_RELAX()     _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define DSP_CPU_RELAX()     __asm__ __volatile__("yield")
+#else
+#define DSP_CPU_RELAX()
+#endif
+
+// Number of spins before a waiting thread gets parked
+#define EVENT_SPIN_COUNT    256
+
+namespace dsp {
+    enum wait_strategy {
+        WAIT_BLOCK,         // Spin briefly then park, the default
+        WAIT_SPIN,          // Never park, lowest wakeup latency but keeps a core busy while waiting
+        WAIT_SPIN_PARK      // Spin for a given budget then park
+    };
+
+    // Lock-free wakeup primitive. Waiters spin briefly on their condition then park
+    // on a futex (or a condition variable on platforms without one). Notifying only
+    // costs a syscall when someone is actually parked.
+    class event {
+    public:
+        // Must only be called while nobody is waiting. spinBudget is only used by WAIT_SPIN_PARK.
+        void setStrategy(wait_strategy strategy, int spinBudget = EVENT_SPIN_COUNT) {
+            _strategy = strategy;
+            _spinBudget = spinBudget;
+        }
+
+        template <class Func>
+        void wait(Func cond) {
+            if (cond()) { return; }
+
+            // Spinners yield now and then so that they can't starve the notifier of a shared core
+            spinners.fetch_add(1, std::memory_order_relaxed);
+            // Unsigned so that WAIT_SPIN can go on forever, the count just wraps around
+            uint32_t budget = std::max<int>((_strategy == WAIT_BLOCK) ? spinCount() : _spinBudget, 0);
+            for (uint32_t i = 1; _strategy == WAIT_SPIN || i <= budget; i++) {
+                DSP_CPU_RELAX();
+                if (cond()) {
+                    spinners.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+                if (_strategy != WAIT_BLOCK && (i % EVENT_SPIN_COUNT) == 0) { std::this_thread::yield(); }
+            }
+            spinners.fetch_sub(1, std::memory_order_relaxed);
+
+            while (true) {
+                uint32_t s = seq.load(std::memory_order_acquire);
+                waiters.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (cond()) {
+                    waiters.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+                park(s);
+                waiters.fetch_sub(1, std::memory_order_relaxed);
+                if (cond()) { return; }
+            }
+        }
+
+        void notify() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            seq.fetch_add(1, std::memory_order_seq_cst);
+            int parked = waiters.load(std::memory_order_seq_cst);
+            if (parked > 0 || spinners.load(std::memory_order_relaxed) > 0) {
+                notifyTime.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+            }
+            if (parked > 0) {
+                wake();
+            }
+        }
+
+        // Time of the last notification that found someone waiting, in steady clock ticks
+        std::chrono::steady_clock::time_point lastNotify() {
+            return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(notifyTime.load(std::memory_order_relaxed)));
+        }
+
+    private:
+        // Spinning is pointless if the other side can't run at the same time
+        static int spinCount() {
+            static const int count = (std::thread::hardware_concurrency() > 1) ? EVENT_SPIN_COUNT : 0;
+            return count;
+        }
+
+#if defined(__linux__)
+        void park(uint32_t s) {
+            syscall(SYS_futex, (uint32_t*)&seq, FUTEX_WAIT_PRIVATE, s, NULL, NULL, 0);
+        }
+
+        void wake() {
+            syscall(SYS_futex, (uint32_t*)&seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+        }
+#else
+        void park(uint32_t s) {
+            std::unique_lock<std::mutex> lck(mtx);
+            cv.wait(lck, [this, s]{ return seq.load(std::memory_order_acquire) != s; });
+        }
+
+        void wake() {
+            { std::lock_guard<std::mutex> lck(mtx); }
+            cv.notify_all();
+        }
+
+        std::mutex mtx;
+        std::condition_variable cv;
+#endif
+
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+        std::atomic<uint32_t> seq{0};
+        std::atomic<int> waiters{0};
+        std::atomic<int> spinners{0};
+        std::atomic<std::chrono::steady_clock::rep> notifyTime{0};
+
+        wait_strategy _strategy = WAIT_BLOCK;
+        int _spinBudget = EVENT_SPIN_COUNT;
+
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <utility>
+#include <fftw3.h>
+
+namespace dsp {
+    enum fft_plan_kind {
+        FFT_C2C_FORWARD,
+        FFT_C2C_BACKWARD,
+        FFT_R2C,
+        FFT_C2R
+    };
+
+    // Process wide cache of out of place fftwf plans, one per kind and size. Planning is
+    // slow and the fftw planner isn't thread safe, executing a plan on other arrays with
+    // fftwf_execute_dft*() is. Those arrays must come from fftwf_malloc() so their alignment
+    // matches the one the plan was made for. Plans live until the process exits.
+    namespace fft_plans {
+        inline fftwf_plan get(fft_plan_kind kind, int size) {
+            static std::mutex mtx;
+            static std::map<std::pair<int, int>, fftwf_plan> plans;
+
+            std::lock_guard<std::mutex> lck(mtx);
+            auto it = plans.find({ kind, size });
+            if (it != plans.end()) { return it->second; }
+
+            // FFTW_MEASURE scribbles over the arrays, so plan on scratch ones
+            fftwf_complex* a = fftwf_alloc_complex(size);
+            fftwf_complex* b = fftwf_alloc_complex(size);
+            fftwf_plan plan;
+            switch (kind) {
+                case FFT_C2C_FORWARD:
+                    plan = fftwf_plan_dft_1d(size, a, b, FFTW_FORWARD, FFTW_MEASURE);
+                    break;
+                case FFT_C2C_BACKWARD:
+                    plan = fftwf_plan_dft_1d(size, a, b, FFTW_BACKWARD, FFTW_MEASURE);
+                    break;
+                case FFT_R2C:
+                    plan = fftwf_plan_dft_r2c_1d(size, (float*)a, b, FFTW_MEASURE);
+                    break;
+                default:
+                    plan = fftwf_plan_dft_c2r_1d(size, a, (float*)b, FFTW_MEASURE);
+                    break;
+            }
+            fftwf_free(a);
+            fftwf_free(b);
+
+            plans[{ kind, size }] = plan;
+            return plan;
+        }
+    }
+}
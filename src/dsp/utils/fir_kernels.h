@@ -0,0 +1,781 @@
+#pragma once
+#include <dsp/types.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FIR_KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FIR_TARGET_AVX2
+#define FIR_TARGET_AVX512
+#else
+#define FIR_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define FIR_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define FIR_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// Below this, AVX-512 wastes most of its lanes and AVX2 is faster
+#define FIR_AVX512_MIN_TAPS     64
+
+// Largest difference between mirrored taps, relative to the largest tap, for them to count as symmetric
+#define FIR_SYMMETRY_TOLERANCE  1e-6f
+
+// Most fractional bits of fixed point taps
+#define FIR_FIXED_MAX_SHIFT     30
+
+// Filtering kernels shared by the FIR blocks. Each one computes count outputs, output i going
+// to out[i * outStep] and being the dot product of the tapCount inputs starting at
+// in[i * inStep] with the taps, the oldest sample going with taps[0]. complex_t and stereo_t
+// data is filtered with real taps. The SIMD flavour is picked once at runtime from what the
+// CPU supports, SSE being the baseline on x86-64 and NEON on ARM64.
+namespace dsp::fir_kernels {
+    enum simd_level {
+        SIMD_GENERIC,
+        SIMD_SSE,
+        SIMD_AVX2,
+        SIMD_AVX512,
+        SIMD_NEON
+    };
+
+    inline simd_level detectSIMD() {
+#if defined(FIR_KERNELS_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        bool fma = info[2] & (1 << 12);
+        bool osxsave = info[2] & (1 << 27);
+        if (!osxsave) { return SIMD_SSE; }
+        uint64_t xcr0 = _xgetbv(0);
+        __cpuidex(info, 7, 0);
+        bool avx2 = info[1] & (1 << 5);
+        bool avx512 = info[1] & (1 << 16);
+        if (avx512 && (xcr0 & 0xE6) == 0xE6) { return SIMD_AVX512; }
+        if (avx2 && fma && (xcr0 & 6) == 6) { return SIMD_AVX2; }
+        return SIMD_SSE;
+#elif defined(FIR_KERNELS_X86)
+        if (__builtin_cpu_supports("avx512f")) { return SIMD_AVX512; }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { return SIMD_AVX2; }
+        return SIMD_SSE;
+#elif defined(FIR_KERNELS_NEON)
+        return SIMD_NEON;
+#else
+        return SIMD_GENERIC;
+#endif
+    }
+
+    inline simd_level& currentLevel() {
+        static simd_level level = detectSIMD();
+        return level;
+    }
+
+    inline simd_level getSIMDLevel() {
+        return currentLevel();
+    }
+
+    // Force a flavour, eg. to compare them. The CPU must support it, SIMD_GENERIC always works.
+    inline void setSIMDLevel(simd_level level) {
+        currentLevel() = level;
+    }
+
+    // True if taps[i] == taps[tapCount - 1 - i] for all i, give or take FIR_SYMMETRY_TOLERANCE
+    inline bool isSymmetric(const float* taps, int tapCount) {
+        float max = 0.0f;
+        for (int i = 0; i < tapCount; i++) {
+            max = std::max<float>(max, fabsf(taps[i]));
+        }
+        float tolerance = max * FIR_SYMMETRY_TOLERANCE;
+        for (int i = 0; i < tapCount / 2; i++) {
+            if (fabsf(taps[i] - taps[tapCount - 1 - i]) > tolerance) { return false; }
+        }
+        return true;
+    }
+
+    // Dot kernels work on a few outputs per pass over the taps so that each tap load is shared
+    // and the accumulators don't wait on each other. Symmetric kernels add each mirrored pair
+    // of samples first, so only the first (tapCount + 1) / 2 taps are read.
+    namespace generic {
+        inline void dot(float* out, const float* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            for (int i = 0; i < count; i++) {
+                const float* x = &in[i * inStep];
+                float sum = 0.0f;
+                for (int k = 0; k < tapCount; k++) {
+                    sum += taps[k] * x[k];
+                }
+                out[i * outStep] = sum;
+            }
+        }
+
+        inline void dot(complex_t* out, const complex_t* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            for (int i = 0; i < count; i++) {
+                const complex_t* x = &in[i * inStep];
+                complex_t sum = { 0.0f, 0.0f };
+                for (int k = 0; k < tapCount; k++) {
+                    sum.re += taps[k] * x[k].re;
+                    sum.im += taps[k] * x[k].im;
+                }
+                out[i * outStep] = sum;
+            }
+        }
+
+        inline void symmetric(float* out, const float* in, const float* taps, int tapCount, int count, int step) {
+            int pairs = tapCount / 2;
+            for (int i = 0; i < count; i++) {
+                const float* x = &in[i * step];
+                float sum = (tapCount & 1) ? (taps[pairs] * x[pairs]) : 0.0f;
+                for (int k = 0; k < pairs; k++) {
+                    sum += taps[k] * (x[k] + x[tapCount - 1 - k]);
+                }
+                out[i] = sum;
+            }
+        }
+
+        inline void symmetric(complex_t* out, const complex_t* in, const float* taps, int tapCount, int count, int step) {
+            int pairs = tapCount / 2;
+            for (int i = 0; i < count; i++) {
+                const complex_t* x = &in[i * step];
+                complex_t sum = { 0.0f, 0.0f };
+                if (tapCount & 1) {
+                    sum = { taps[pairs] * x[pairs].re, taps[pairs] * x[pairs].im };
+                }
+                for (int k = 0; k < pairs; k++) {
+                    sum.re += taps[k] * (x[k].re + x[tapCount - 1 - k].re);
+                    sum.im += taps[k] * (x[k].im + x[tapCount - 1 - k].im);
+                }
+                out[i] = sum;
+            }
+        }
+    }
+
+#ifdef FIR_KERNELS_X86
+    namespace sse {
+        inline float hsum(__m128 v) {
+            v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+            v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+            return _mm_cvtss_f32(v);
+        }
+
+        // (re, im, re, im) to the complex sum
+        inline complex_t csum(__m128 v) {
+            v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+            return { _mm_cvtss_f32(v), _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))) };
+        }
+
+        inline void dot(float* out, const float* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~3;
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const float* x[4] = { &in[i * inStep], &in[(i + 1) * inStep], &in[(i + 2) * inStep], &in[(i + 3) * inStep] };
+                __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 4) {
+                    __m128 t = _mm_loadu_ps(&taps[k]);
+                    a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(&x[0][k]), t));
+                    a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(&x[1][k]), t));
+                    a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(&x[2][k]), t));
+                    a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(&x[3][k]), t));
+                }
+                _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+                float sums[4];
+                _mm_storeu_ps(sums, _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3)));
+                for (int j = 0; j < 4; j++) {
+                    for (int k = vecTaps; k < tapCount; k++) {
+                        sums[j] += taps[k] * x[j][k];
+                    }
+                    out[(i + j) * outStep] = sums[j];
+                }
+            }
+            for (; i < count; i++) {
+                const float* x = &in[i * inStep];
+                __m128 acc = _mm_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 4) {
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&x[k]), _mm_loadu_ps(&taps[k])));
+                }
+                float sum = hsum(acc);
+                for (int k = vecTaps; k < tapCount; k++) {
+                    sum += taps[k] * x[k];
+                }
+                out[i * outStep] = sum;
+            }
+        }
+
+        inline void dot(complex_t* out, const complex_t* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~1;
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const float* x[4] = { (const float*)&in[i * inStep], (const float*)&in[(i + 1) * inStep], (const float*)&in[(i + 2) * inStep], (const float*)&in[(i + 3) * inStep] };
+                __m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 2) {
+                    __m128 t = _mm_castpd_ps(_mm_load_sd((const double*)&taps[k]));
+                    t = _mm_unpacklo_ps(t, t);
+                    a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_loadu_ps(&x[0][2 * k]), t));
+                    a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_loadu_ps(&x[1][2 * k]), t));
+                    a2 = _mm_add_ps(a2, _mm_mul_ps(_mm_loadu_ps(&x[2][2 * k]), t));
+                    a3 = _mm_add_ps(a3, _mm_mul_ps(_mm_loadu_ps(&x[3][2 * k]), t));
+                }
+                complex_t sums[4] = { csum(a0), csum(a1), csum(a2), csum(a3) };
+                for (int j = 0; j < 4; j++) {
+                    if (tapCount & 1) {
+                        sums[j].re += taps[vecTaps] * x[j][2 * vecTaps];
+                        sums[j].im += taps[vecTaps] * x[j][(2 * vecTaps) + 1];
+                    }
+                    out[(i + j) * outStep] = sums[j];
+                }
+            }
+            for (; i < count; i++) {
+                const float* x = (const float*)&in[i * inStep];
+                __m128 acc = _mm_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 2) {
+                    __m128 t = _mm_castpd_ps(_mm_load_sd((const double*)&taps[k]));
+                    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(&x[2 * k]), _mm_unpacklo_ps(t, t)));
+                }
+                complex_t sum = csum(acc);
+                if (tapCount & 1) {
+                    sum.re += taps[vecTaps] * x[2 * vecTaps];
+                    sum.im += taps[vecTaps] * x[(2 * vecTaps) + 1];
+                }
+                out[i * outStep] = sum;
+            }
+        }
+
+    }
+
+    namespace avx2 {
+        FIR_TARGET_AVX2 inline __m128 reduce(__m256 v) {
+            return _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        }
+
+        // Lanes below count set, for loading the last partial chunk without reading past it
+        FIR_TARGET_AVX2 inline __m256i tailMask(int count) {
+            return _mm256_cmpgt_epi32(_mm256_set1_epi32(count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        }
+
+        FIR_TARGET_AVX2 inline void dot(float* out, const float* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~7;
+            bool tail = (tapCount & 7);
+            __m256i mask = tailMask(tapCount & 7);
+            __m256 tailTaps = _mm256_maskload_ps(&taps[vecTaps], mask);
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const float* x0 = &in[i * inStep];
+                const float* x1 = x0 + inStep;
+                const float* x2 = x1 + inStep;
+                const float* x3 = x2 + inStep;
+                __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 8) {
+                    __m256 t = _mm256_loadu_ps(&taps[k]);
+                    a0 = _mm256_fmadd_ps(_mm256_loadu_ps(&x0[k]), t, a0);
+                    a1 = _mm256_fmadd_ps(_mm256_loadu_ps(&x1[k]), t, a1);
+                    a2 = _mm256_fmadd_ps(_mm256_loadu_ps(&x2[k]), t, a2);
+                    a3 = _mm256_fmadd_ps(_mm256_loadu_ps(&x3[k]), t, a3);
+                }
+                if (tail) {
+                    a0 = _mm256_fmadd_ps(_mm256_maskload_ps(&x0[vecTaps], mask), tailTaps, a0);
+                    a1 = _mm256_fmadd_ps(_mm256_maskload_ps(&x1[vecTaps], mask), tailTaps, a1);
+                    a2 = _mm256_fmadd_ps(_mm256_maskload_ps(&x2[vecTaps], mask), tailTaps, a2);
+                    a3 = _mm256_fmadd_ps(_mm256_maskload_ps(&x3[vecTaps], mask), tailTaps, a3);
+                }
+
+                // Lane j of the result ends up with the sum of aj
+                __m256 h = _mm256_hadd_ps(_mm256_hadd_ps(a0, a1), _mm256_hadd_ps(a2, a3));
+                __m128 sums = reduce(h);
+                if (outStep == 1) {
+                    _mm_storeu_ps(&out[i], sums);
+                }
+                else {
+                    float s[4];
+                    _mm_storeu_ps(s, sums);
+                    for (int j = 0; j < 4; j++) { out[(i + j) * outStep] = s[j]; }
+                }
+            }
+            for (; i < count; i++) {
+                const float* x = &in[i * inStep];
+                __m256 acc = _mm256_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 8) {
+                    acc = _mm256_fmadd_ps(_mm256_loadu_ps(&x[k]), _mm256_loadu_ps(&taps[k]), acc);
+                }
+                if (tail) {
+                    acc = _mm256_fmadd_ps(_mm256_maskload_ps(&x[vecTaps], mask), tailTaps, acc);
+                }
+                out[i * outStep] = sse::hsum(reduce(acc));
+            }
+        }
+
+        FIR_TARGET_AVX2 inline void dot(complex_t* out, const complex_t* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~3;
+            bool tail = (tapCount & 3);
+            const __m256i duplicate = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+            __m256i mask = tailMask(2 * (tapCount & 3));
+            __m256 tailTaps = _mm256_permutevar8x32_ps(_mm256_maskload_ps(&taps[vecTaps], tailMask(tapCount & 3)), duplicate);
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const float* x0 = (const float*)&in[i * inStep];
+                const float* x1 = x0 + (2 * inStep);
+                const float* x2 = x1 + (2 * inStep);
+                const float* x3 = x2 + (2 * inStep);
+                __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 4) {
+                    __m256 t = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(&taps[k])), duplicate);
+                    a0 = _mm256_fmadd_ps(_mm256_loadu_ps(&x0[2 * k]), t, a0);
+                    a1 = _mm256_fmadd_ps(_mm256_loadu_ps(&x1[2 * k]), t, a1);
+                    a2 = _mm256_fmadd_ps(_mm256_loadu_ps(&x2[2 * k]), t, a2);
+                    a3 = _mm256_fmadd_ps(_mm256_loadu_ps(&x3[2 * k]), t, a3);
+                }
+                if (tail) {
+                    a0 = _mm256_fmadd_ps(_mm256_maskload_ps(&x0[2 * vecTaps], mask), tailTaps, a0);
+                    a1 = _mm256_fmadd_ps(_mm256_maskload_ps(&x1[2 * vecTaps], mask), tailTaps, a1);
+                    a2 = _mm256_fmadd_ps(_mm256_maskload_ps(&x2[2 * vecTaps], mask), tailTaps, a2);
+                    a3 = _mm256_fmadd_ps(_mm256_maskload_ps(&x3[2 * vecTaps], mask), tailTaps, a3);
+                }
+                out[i * outStep] = sse::csum(reduce(a0));
+                out[(i + 1) * outStep] = sse::csum(reduce(a1));
+                out[(i + 2) * outStep] = sse::csum(reduce(a2));
+                out[(i + 3) * outStep] = sse::csum(reduce(a3));
+            }
+            for (; i < count; i++) {
+                const float* x = (const float*)&in[i * inStep];
+                __m256 acc = _mm256_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 4) {
+                    __m256 t = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(&taps[k])), duplicate);
+                    acc = _mm256_fmadd_ps(_mm256_loadu_ps(&x[2 * k]), t, acc);
+                }
+                if (tail) {
+                    acc = _mm256_fmadd_ps(_mm256_maskload_ps(&x[2 * vecTaps], mask), tailTaps, acc);
+                }
+                out[i * outStep] = sse::csum(reduce(acc));
+            }
+        }
+
+    }
+
+    namespace avx512 {
+        FIR_TARGET_AVX512 inline void dot(float* out, const float* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~15;
+            bool tail = (tapCount & 15);
+            __mmask16 mask = (1 << (tapCount & 15)) - 1;
+            __m512 tailTaps = _mm512_maskz_loadu_ps(mask, &taps[vecTaps]);
+            int i = 0;
+            for (; i + 8 <= count; i += 8) {
+                const float* x = &in[i * inStep];
+                __m512 acc[8];
+                for (int j = 0; j < 8; j++) { acc[j] = _mm512_setzero_ps(); }
+                for (int k = 0; k < vecTaps; k += 16) {
+                    __m512 t = _mm512_loadu_ps(&taps[k]);
+                    for (int j = 0; j < 8; j++) {
+                        acc[j] = _mm512_fmadd_ps(_mm512_loadu_ps(&x[(j * inStep) + k]), t, acc[j]);
+                    }
+                }
+                if (tail) {
+                    for (int j = 0; j < 8; j++) {
+                        acc[j] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, &x[(j * inStep) + vecTaps]), tailTaps, acc[j]);
+                    }
+                }
+                for (int j = 0; j < 8; j++) {
+                    out[(i + j) * outStep] = _mm512_reduce_add_ps(acc[j]);
+                }
+            }
+            for (; i < count; i++) {
+                const float* x = &in[i * inStep];
+                __m512 acc = _mm512_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 16) {
+                    acc = _mm512_fmadd_ps(_mm512_loadu_ps(&x[k]), _mm512_loadu_ps(&taps[k]), acc);
+                }
+                if (tail) {
+                    acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, &x[vecTaps]), tailTaps, acc);
+                }
+                out[i * outStep] = _mm512_reduce_add_ps(acc);
+            }
+        }
+
+        FIR_TARGET_AVX512 inline complex_t csum(__m512 v) {
+            return { _mm512_mask_reduce_add_ps(0x5555, v), _mm512_mask_reduce_add_ps(0xAAAA, v) };
+        }
+
+        FIR_TARGET_AVX512 inline void dot(complex_t* out, const complex_t* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~7;
+            bool tail = (tapCount & 7);
+            const __m512i duplicate = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+            __mmask16 mask = (1 << (2 * (tapCount & 7))) - 1;
+            __m512 tailTaps = _mm512_permutexvar_ps(duplicate, _mm512_maskz_loadu_ps((1 << (tapCount & 7)) - 1, &taps[vecTaps]));
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const float* x = (const float*)&in[i * inStep];
+                __m512 acc[4];
+                for (int j = 0; j < 4; j++) { acc[j] = _mm512_setzero_ps(); }
+                for (int k = 0; k < vecTaps; k += 8) {
+                    __m512 t = _mm512_permutexvar_ps(duplicate, _mm512_maskz_loadu_ps(0xFF, &taps[k]));
+                    for (int j = 0; j < 4; j++) {
+                        acc[j] = _mm512_fmadd_ps(_mm512_loadu_ps(&x[2 * ((j * inStep) + k)]), t, acc[j]);
+                    }
+                }
+                if (tail) {
+                    for (int j = 0; j < 4; j++) {
+                        acc[j] = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, &x[2 * ((j * inStep) + vecTaps)]), tailTaps, acc[j]);
+                    }
+                }
+                for (int j = 0; j < 4; j++) {
+                    out[(i + j) * outStep] = csum(acc[j]);
+                }
+            }
+            for (; i < count; i++) {
+                const float* x = (const float*)&in[i * inStep];
+                __m512 acc = _mm512_setzero_ps();
+                for (int k = 0; k < vecTaps; k += 8) {
+                    __m512 t = _mm512_permutexvar_ps(duplicate, _mm512_maskz_loadu_ps(0xFF, &taps[k]));
+                    acc = _mm512_fmadd_ps(_mm512_loadu_ps(&x[2 * k]), t, acc);
+                }
+                if (tail) {
+                    acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, &x[2 * vecTaps]), tailTaps, acc);
+                }
+                out[i * outStep] = csum(acc);
+            }
+        }
+    }
+#endif
+
+#ifdef FIR_KERNELS_NEON
+    namespace neon {
+        inline void dot(float* out, const float* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~3;
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const float* x[4] = { &in[i * inStep], &in[(i + 1) * inStep], &in[(i + 2) * inStep], &in[(i + 3) * inStep] };
+                float32x4_t acc[4];
+                for (int j = 0; j < 4; j++) { acc[j] = vdupq_n_f32(0.0f); }
+                for (int k = 0; k < vecTaps; k += 4) {
+                    float32x4_t t = vld1q_f32(&taps[k]);
+                    for (int j = 0; j < 4; j++) {
+                        acc[j] = vfmaq_f32(acc[j], vld1q_f32(&x[j][k]), t);
+                    }
+                }
+                for (int j = 0; j < 4; j++) {
+                    float sum = vaddvq_f32(acc[j]);
+                    for (int k = vecTaps; k < tapCount; k++) {
+                        sum += taps[k] * x[j][k];
+                    }
+                    out[(i + j) * outStep] = sum;
+                }
+            }
+            for (; i < count; i++) {
+                const float* x = &in[i * inStep];
+                float32x4_t acc = vdupq_n_f32(0.0f);
+                for (int k = 0; k < vecTaps; k += 4) {
+                    acc = vfmaq_f32(acc, vld1q_f32(&x[k]), vld1q_f32(&taps[k]));
+                }
+                float sum = vaddvq_f32(acc);
+                for (int k = vecTaps; k < tapCount; k++) {
+                    sum += taps[k] * x[k];
+                }
+                out[i * outStep] = sum;
+            }
+        }
+
+        // vld2q splits 4 samples into their real and imaginary parts, so the taps need no shuffling
+        inline void dot(complex_t* out, const complex_t* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~3;
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const complex_t* x[4] = { &in[i * inStep], &in[(i + 1) * inStep], &in[(i + 2) * inStep], &in[(i + 3) * inStep] };
+                float32x4_t re[4], im[4];
+                for (int j = 0; j < 4; j++) { re[j] = vdupq_n_f32(0.0f); im[j] = vdupq_n_f32(0.0f); }
+                for (int k = 0; k < vecTaps; k += 4) {
+                    float32x4_t t = vld1q_f32(&taps[k]);
+                    for (int j = 0; j < 4; j++) {
+                        float32x4x2_t v = vld2q_f32((const float*)&x[j][k]);
+                        re[j] = vfmaq_f32(re[j], v.val[0], t);
+                        im[j] = vfmaq_f32(im[j], v.val[1], t);
+                    }
+                }
+                for (int j = 0; j < 4; j++) {
+                    complex_t sum = { vaddvq_f32(re[j]), vaddvq_f32(im[j]) };
+                    for (int k = vecTaps; k < tapCount; k++) {
+                        sum.re += taps[k] * x[j][k].re;
+                        sum.im += taps[k] * x[j][k].im;
+                    }
+                    out[(i + j) * outStep] = sum;
+                }
+            }
+            for (; i < count; i++) {
+                const complex_t* x = &in[i * inStep];
+                float32x4_t re = vdupq_n_f32(0.0f), im = vdupq_n_f32(0.0f);
+                for (int k = 0; k < vecTaps; k += 4) {
+                    float32x4_t t = vld1q_f32(&taps[k]);
+                    float32x4x2_t v = vld2q_f32((const float*)&x[k]);
+                    re = vfmaq_f32(re, v.val[0], t);
+                    im = vfmaq_f32(im, v.val[1], t);
+                }
+                complex_t sum = { vaddvq_f32(re), vaddvq_f32(im) };
+                for (int k = vecTaps; k < tapCount; k++) {
+                    sum.re += taps[k] * x[k].re;
+                    sum.im += taps[k] * x[k].im;
+                }
+                out[i * outStep] = sum;
+            }
+        }
+    }
+#endif
+
+    template <class T>
+    inline void dotImpl(T* out, const T* in, const float* taps, int tapCount, int count, int inStep, int outStep) {
+        switch (getSIMDLevel()) {
+#ifdef FIR_KERNELS_X86
+            case SIMD_AVX512:
+                if (tapCount >= FIR_AVX512_MIN_TAPS) {
+                    avx512::dot(out, in, taps, tapCount, count, inStep, outStep);
+                    return;
+                }
+                [[fallthrough]];
+            case SIMD_AVX2:
+                avx2::dot(out, in, taps, tapCount, count, inStep, outStep);
+                return;
+            case SIMD_SSE:
+                sse::dot(out, in, taps, tapCount, count, inStep, outStep);
+                return;
+#endif
+#ifdef FIR_KERNELS_NEON
+            case SIMD_NEON:
+                neon::dot(out, in, taps, tapCount, count, inStep, outStep);
+                return;
+#endif
+            default:
+                generic::dot(out, in, taps, tapCount, count, inStep, outStep);
+                return;
+        }
+    }
+
+    // Plain filter, one call computes a whole buffer. Use count = 1 for a single output.
+    template <class T>
+    inline void dot(T* out, const T* in, const float* taps, int tapCount, int count, int inStep = 1, int outStep = 1) {
+        if constexpr (std::is_same_v<T, float>) {
+            dotImpl<float>(out, in, taps, tapCount, count, inStep, outStep);
+        }
+        else {
+            static_assert(sizeof(T) == sizeof(complex_t), "Unsupported sample type");
+            dotImpl<complex_t>((complex_t*)out, (const complex_t*)in, taps, tapCount, count, inStep, outStep);
+        }
+    }
+
+    // Filter with symmetric taps, about half the multiplies of a plain dot product. Generic code only,
+    // the vector kernels are bound by loads rather than multiplies so folding the taps doesn't pay off there.
+    template <class T>
+    inline void symmetric(T* out, const T* in, const float* taps, int tapCount, int count, int step = 1) {
+        if constexpr (std::is_same_v<T, float>) {
+            generic::symmetric(out, in, taps, tapCount, count, step);
+        }
+        else {
+            static_assert(sizeof(T) == sizeof(complex_t), "Unsupported sample type");
+            generic::symmetric((complex_t*)out, (const complex_t*)in, taps, tapCount, count, step);
+        }
+    }
+
+    // Picks the faster kernel for the taps, the symmetric one only wins over the generic dot product
+    // (see bench/fir_bench.cpp).
+    template <class T>
+    inline void filter(T* out, const T* in, const float* taps, int tapCount, bool symmetric, int count, int inStep = 1) {
+        if (symmetric && getSIMDLevel() == SIMD_GENERIC) {
+            fir_kernels::symmetric(out, in, taps, tapCount, count, inStep);
+        }
+        else {
+            dot(out, in, taps, tapCount, count, inStep);
+        }
+    }
+
+    // Fixed point kernels for complex_int16 data. The taps are integers scaled by 2^shift, each
+    // one stored twice in a row for the real and imaginary parts (see packFixedTaps()). Products
+    // are summed exactly in 32 bits, the sum is then rounded, shifted back and saturated.
+
+    // Largest shift that keeps every tap in an int16 and the sums of full scale inputs in 32 bits
+    inline int fixedTapShift(const float* taps, int tapCount) {
+        double sum = 0.0;
+        double max = 0.0;
+        for (int i = 0; i < tapCount; i++) {
+            sum += fabs(taps[i]);
+            max = std::max<double>(max, fabs(taps[i]));
+        }
+        int shift = 0;
+        while (shift < FIR_FIXED_MAX_SHIFT) {
+            double scale = ldexp(1.0, shift + 1);
+            // Rounding each tap adds up to half a step to the sum
+            if ((max * scale) + 0.5 > 32767.0 || (((sum * scale) + (tapCount * 0.5)) * 32768.0) + scale >= 2147483647.0) { break; }
+            shift++;
+        }
+        return shift;
+    }
+
+    // out must hold 2 * tapCount values
+    inline void packFixedTaps(int16_t* out, const float* taps, int tapCount, int shift) {
+        float scale = ldexp(1.0f, shift);
+        for (int i = 0; i < tapCount; i++) {
+            out[2 * i] = (int16_t)std::clamp<long>(lrintf(taps[i] * scale), -32768, 32767);
+            out[(2 * i) + 1] = out[2 * i];
+        }
+    }
+
+    inline int16_t saturate16(int32_t val) {
+        return (int16_t)std::clamp<int32_t>(val, -32768, 32767);
+    }
+
+    namespace generic {
+        inline void dotFixed(complex_int16* out, const complex_int16* in, const int16_t* taps, int tapCount, int shift, int count, int inStep, int outStep) {
+            int32_t round = (1 << shift) >> 1;
+            for (int i = 0; i < count; i++) {
+                const complex_int16* x = &in[i * inStep];
+                int32_t re = round;
+                int32_t im = round;
+                for (int k = 0; k < tapCount; k++) {
+                    re += (int32_t)x[k].re * taps[2 * k];
+                    im += (int32_t)x[k].im * taps[(2 * k) + 1];
+                }
+                out[i * outStep] = { saturate16(re >> shift), saturate16(im >> shift) };
+            }
+        }
+    }
+
+#ifdef FIR_KERNELS_X86
+    namespace sse {
+        // Adds the products of 4 samples to acc, as (re, im, re, im)
+        inline __m128i mulFixed(__m128i acc, __m128i x, __m128i t) {
+            __m128i lo = _mm_mullo_epi16(x, t);
+            __m128i hi = _mm_mulhi_epi16(x, t);
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(lo, hi));
+            return _mm_add_epi32(acc, _mm_unpackhi_epi16(lo, hi));
+        }
+
+        // Adds up an (re, im, re, im) sum and the taps the vector loop left, then rounds, shifts and saturates
+        inline complex_int16 finishFixed(__m128i acc, const complex_int16* x, const int16_t* taps, int from, int tapCount, int shift) {
+            int32_t sums[4];
+            _mm_storeu_si128((__m128i*)sums, _mm_add_epi32(acc, _mm_unpackhi_epi64(acc, acc)));
+            int32_t re = sums[0] + ((1 << shift) >> 1);
+            int32_t im = sums[1] + ((1 << shift) >> 1);
+            for (int k = from; k < tapCount; k++) {
+                re += (int32_t)x[k].re * taps[2 * k];
+                im += (int32_t)x[k].im * taps[(2 * k) + 1];
+            }
+            return { saturate16(re >> shift), saturate16(im >> shift) };
+        }
+
+        inline void dotFixed(complex_int16* out, const complex_int16* in, const int16_t* taps, int tapCount, int shift, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~3;
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const complex_int16* x[4] = { &in[i * inStep], &in[(i + 1) * inStep], &in[(i + 2) * inStep], &in[(i + 3) * inStep] };
+                __m128i a0 = _mm_setzero_si128(), a1 = _mm_setzero_si128(), a2 = _mm_setzero_si128(), a3 = _mm_setzero_si128();
+                for (int k = 0; k < vecTaps; k += 4) {
+                    __m128i t = _mm_loadu_si128((const __m128i*)&taps[2 * k]);
+                    a0 = mulFixed(a0, _mm_loadu_si128((const __m128i*)&x[0][k]), t);
+                    a1 = mulFixed(a1, _mm_loadu_si128((const __m128i*)&x[1][k]), t);
+                    a2 = mulFixed(a2, _mm_loadu_si128((const __m128i*)&x[2][k]), t);
+                    a3 = mulFixed(a3, _mm_loadu_si128((const __m128i*)&x[3][k]), t);
+                }
+                out[i * outStep] = finishFixed(a0, x[0], taps, vecTaps, tapCount, shift);
+                out[(i + 1) * outStep] = finishFixed(a1, x[1], taps, vecTaps, tapCount, shift);
+                out[(i + 2) * outStep] = finishFixed(a2, x[2], taps, vecTaps, tapCount, shift);
+                out[(i + 3) * outStep] = finishFixed(a3, x[3], taps, vecTaps, tapCount, shift);
+            }
+            for (; i < count; i++) {
+                const complex_int16* x = &in[i * inStep];
+                __m128i acc = _mm_setzero_si128();
+                for (int k = 0; k < vecTaps; k += 4) {
+                    acc = mulFixed(acc, _mm_loadu_si128((const __m128i*)&x[k]), _mm_loadu_si128((const __m128i*)&taps[2 * k]));
+                }
+                out[i * outStep] = finishFixed(acc, x, taps, vecTaps, tapCount, shift);
+            }
+        }
+    }
+
+    namespace avx2 {
+        FIR_TARGET_AVX2 inline __m256i mulFixed(__m256i acc, __m256i x, __m256i t) {
+            __m256i lo = _mm256_mullo_epi16(x, t);
+            __m256i hi = _mm256_mulhi_epi16(x, t);
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(lo, hi));
+            return _mm256_add_epi32(acc, _mm256_unpackhi_epi16(lo, hi));
+        }
+
+        FIR_TARGET_AVX2 inline complex_int16 finishFixed(__m256i acc, const complex_int16* x, const int16_t* taps, int from, int tapCount, int shift) {
+            __m128i acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+            return sse::finishFixed(acc128, x, taps, from, tapCount, shift);
+        }
+
+        FIR_TARGET_AVX2 inline void dotFixed(complex_int16* out, const complex_int16* in, const int16_t* taps, int tapCount, int shift, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~7;
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const complex_int16* x[4] = { &in[i * inStep], &in[(i + 1) * inStep], &in[(i + 2) * inStep], &in[(i + 3) * inStep] };
+                __m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256(), a2 = _mm256_setzero_si256(), a3 = _mm256_setzero_si256();
+                for (int k = 0; k < vecTaps; k += 8) {
+                    __m256i t = _mm256_loadu_si256((const __m256i*)&taps[2 * k]);
+                    a0 = mulFixed(a0, _mm256_loadu_si256((const __m256i*)&x[0][k]), t);
+                    a1 = mulFixed(a1, _mm256_loadu_si256((const __m256i*)&x[1][k]), t);
+                    a2 = mulFixed(a2, _mm256_loadu_si256((const __m256i*)&x[2][k]), t);
+                    a3 = mulFixed(a3, _mm256_loadu_si256((const __m256i*)&x[3][k]), t);
+                }
+                out[i * outStep] = finishFixed(a0, x[0], taps, vecTaps, tapCount, shift);
+                out[(i + 1) * outStep] = finishFixed(a1, x[1], taps, vecTaps, tapCount, shift);
+                out[(i + 2) * outStep] = finishFixed(a2, x[2], taps, vecTaps, tapCount, shift);
+                out[(i + 3) * outStep] = finishFixed(a3, x[3], taps, vecTaps, tapCount, shift);
+            }
+            for (; i < count; i++) {
+                const complex_int16* x = &in[i * inStep];
+                __m256i acc = _mm256_setzero_si256();
+                for (int k = 0; k < vecTaps; k += 8) {
+                    acc = mulFixed(acc, _mm256_loadu_si256((const __m256i*)&x[k]), _mm256_loadu_si256((const __m256i*)&taps[2 * k]));
+                }
+                out[i * outStep] = finishFixed(acc, x, taps, vecTaps, tapCount, shift);
+            }
+        }
+    }
+#endif
+
+#ifdef FIR_KERNELS_NEON
+    namespace neon {
+        inline void dotFixed(complex_int16* out, const complex_int16* in, const int16_t* taps, int tapCount, int shift, int count, int inStep, int outStep) {
+            int vecTaps = tapCount & ~3;
+            for (int i = 0; i < count; i++) {
+                const complex_int16* x = &in[i * inStep];
+                int32x4_t acc = vdupq_n_s32(0);
+                for (int k = 0; k < vecTaps; k += 4) {
+                    int16x8_t d = vld1q_s16((const int16_t*)&x[k]);
+                    int16x8_t t = vld1q_s16(&taps[2 * k]);
+                    acc = vmlal_s16(acc, vget_low_s16(d), vget_low_s16(t));
+                    acc = vmlal_high_s16(acc, d, t);
+                }
+                int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+                int32_t re = vget_lane_s32(sum, 0) + ((1 << shift) >> 1);
+                int32_t im = vget_lane_s32(sum, 1) + ((1 << shift) >> 1);
+                for (int k = vecTaps; k < tapCount; k++) {
+                    re += (int32_t)x[k].re * taps[2 * k];
+                    im += (int32_t)x[k].im * taps[(2 * k) + 1];
+                }
+                out[i * outStep] = { saturate16(re >> shift), saturate16(im >> shift) };
+            }
+        }
+    }
+#endif
+
+    // Fixed point filter, taps from packFixedTaps() with the shift given by fixedTapShift()
+    inline void dotFixed(complex_int16* out, const complex_int16* in, const int16_t* taps, int tapCount, int shift, int count, int inStep = 1, int outStep = 1) {
+        switch (getSIMDLevel()) {
+#ifdef FIR_KERNELS_X86
+            case SIMD_AVX512:
+            case SIMD_AVX2:
+                avx2::dotFixed(out, in, taps, tapCount, shift, count, inStep, outStep);
+                return;
+            case SIMD_SSE:
+                sse::dotFixed(out, in, taps, tapCount, shift, count, inStep, outStep);
+                return;
+#endif
+#ifdef FIR_KERNELS_NEON
+            case SIMD_NEON:
+                neon::dotFixed(out, in, taps, tapCount, shift, count, inStep, outStep);
+                return;
+#endif
+            default:
+                generic::dotFixed(out, in, taps, tapCount, shift, count, inStep, outStep);
+                return;
+        }
+    }
+}
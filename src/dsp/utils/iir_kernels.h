@@ -0,0 +1,316 @@
+#pragma once
+#include <dsp/utils/fir_kernels.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Default Q of biquad::lowpass() and biquad::highpass(), Butterworth
+#define BIQUAD_BUTTERWORTH_Q    0.70710678f
+
+// Sections with poles closer than this to the unit circle run sample by sample, the look-ahead
+// matrices of such sections lose too much to rounding (a few times the error of the plain form
+// at 0.002, unstable at 0.0002)
+#define IIR_LOOKAHEAD_MIN_MARGIN    0.005
+
+namespace dsp {
+    // One second order section, y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+    struct biquad {
+        float b0, b1, b2;
+        float a1, a2;
+
+        // First order low-pass with time constant tau (in seconds), eg. FM de-emphasis
+        static biquad onePoleLowpass(float sampleRate, float tau) {
+            float dt = 1.0f / sampleRate;
+            float alpha = dt / (tau + dt);
+            return { alpha, 0.0f, 0.0f, alpha - 1.0f, 0.0f };
+        }
+
+        // RBJ audio EQ cookbook low-pass
+        static biquad lowpass(float sampleRate, float cutoff, float q = BIQUAD_BUTTERWORTH_Q) {
+            double w = 2.0 * FL_M_PI * cutoff / sampleRate;
+            double alpha = sin(w) / (2.0 * q);
+            double a0 = 1.0 + alpha;
+            double b = (1.0 - cos(w)) / 2.0;
+            return { (float)(b / a0), (float)(2.0 * b / a0), (float)(b / a0), (float)(-2.0 * cos(w) / a0), (float)((1.0 - alpha) / a0) };
+        }
+
+        // RBJ audio EQ cookbook high-pass
+        static biquad highpass(float sampleRate, float cutoff, float q = BIQUAD_BUTTERWORTH_Q) {
+            double w = 2.0 * FL_M_PI * cutoff / sampleRate;
+            double alpha = sin(w) / (2.0 * q);
+            double a0 = 1.0 + alpha;
+            double b = (1.0 + cos(w)) / 2.0;
+            return { (float)(b / a0), (float)(-2.0 * b / a0), (float)(b / a0), (float)(-2.0 * cos(w) / a0), (float)((1.0 - alpha) / a0) };
+        }
+    };
+}
+
+// Biquad kernels shared by the IIR blocks. Each one runs count samples of one section in
+// transposed direct form II, out may be the same as in. The state of a section is s1 for
+// every channel followed by s2 for every channel and is updated in place. float data uses a
+// look-ahead form where a block of outputs and the state after it are computed straight from
+// the state before and the block's inputs, leaving one short dependency per block instead of
+// one per sample. Two channel data (stereo_t, complex_t) runs both channels side by side in
+// SIMD lanes. The SIMD flavour is the one picked by fir_kernels.
+namespace dsp::iir_kernels {
+    // Flushes denormals to zero on this thread while in scope. A decaying IIR state goes
+    // through denormals on its way to zero and most CPUs are very slow with those.
+    class flush_denormals {
+    public:
+        flush_denormals() {
+#if defined(FIR_KERNELS_X86)
+            saved = _mm_getcsr();
+            _mm_setcsr(saved | 0x8040);     // FTZ and DAZ
+#elif defined(FIR_KERNELS_NEON) && !defined(_MSC_VER)
+            uint64_t fpcr;
+            asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+            saved = fpcr;
+            asm volatile("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));    // FZ
+#endif
+        }
+
+        ~flush_denormals() {
+#if defined(FIR_KERNELS_X86)
+            _mm_setcsr(saved);
+#elif defined(FIR_KERNELS_NEON) && !defined(_MSC_VER)
+            uint64_t fpcr = saved;
+            asm volatile("msr fpcr, %0" : : "r"(fpcr));
+#endif
+        }
+
+    private:
+        uint64_t saved = 0;
+
+    };
+
+    // Largest pole magnitude of a section
+    inline double poleRadius(const biquad& c) {
+        double d = ((double)c.a1 * c.a1) - (4.0 * c.a2);
+        if (d < 0.0) { return sqrt(c.a2); }
+        return (fabs(c.a1) + sqrt(d)) / 2.0;
+    }
+
+    // Block form of a section: L outputs and the new s1 and s2 as a linear function of the old
+    // s1 and s2 (columns 0 and 1) and of the L inputs (column 2 + j for input j)
+    template <int L>
+    struct lookahead {
+        lookahead(const biquad& c) {
+            for (int col = 0; col < L + 2; col++) {
+                double s1 = (col == 0);
+                double s2 = (col == 1);
+                for (int n = 0; n < L; n++) {
+                    double x = (col == n + 2);
+                    double y = (c.b0 * x) + s1;
+                    s1 = (c.b1 * x) - (c.a1 * y) + s2;
+                    s2 = (c.b2 * x) - (c.a2 * y);
+                    out[col][n] = y;
+                }
+                state[col][0] = s1;
+                state[col][1] = s2;
+                state[col][2] = 0.0f;
+                state[col][3] = 0.0f;
+            }
+        }
+
+        alignas(32) float out[L + 2][L];
+        alignas(16) float state[L + 2][4];
+    };
+
+    namespace generic {
+        template <int CH>
+        inline void section(float* out, const float* in, int count, const biquad& c, float* state) {
+            for (int ch = 0; ch < CH; ch++) {
+                float s1 = state[ch];
+                float s2 = state[CH + ch];
+                for (int i = 0; i < count; i++) {
+                    float x = in[(i * CH) + ch];
+                    float y = (c.b0 * x) + s1;
+                    s1 = ((c.b1 * x) - (c.a1 * y)) + s2;
+                    s2 = (c.b2 * x) - (c.a2 * y);
+                    out[(i * CH) + ch] = y;
+                }
+                state[ch] = s1;
+                state[CH + ch] = s2;
+            }
+        }
+    }
+
+#ifdef FIR_KERNELS_X86
+    namespace sse {
+        inline void section1(float* out, const float* in, int count, const biquad& c, float* state) {
+            lookahead<4> m(c);
+            __m128 st = _mm_setr_ps(state[0], state[1], 0.0f, 0.0f);
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                // Input terms first, they don't wait on the previous block
+                __m128 x = _mm_loadu_ps(&in[i]);
+                __m128 x0 = _mm_shuffle_ps(x, x, 0x00);
+                __m128 x1 = _mm_shuffle_ps(x, x, 0x55);
+                __m128 x2 = _mm_shuffle_ps(x, x, 0xAA);
+                __m128 x3 = _mm_shuffle_ps(x, x, 0xFF);
+                __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, _mm_load_ps(m.out[2])), _mm_mul_ps(x1, _mm_load_ps(m.out[3]))),
+                                      _mm_add_ps(_mm_mul_ps(x2, _mm_load_ps(m.out[4])), _mm_mul_ps(x3, _mm_load_ps(m.out[5]))));
+                __m128 s = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, _mm_load_ps(m.state[2])), _mm_mul_ps(x1, _mm_load_ps(m.state[3]))),
+                                      _mm_add_ps(_mm_mul_ps(x2, _mm_load_ps(m.state[4])), _mm_mul_ps(x3, _mm_load_ps(m.state[5]))));
+
+                __m128 s1 = _mm_shuffle_ps(st, st, 0x00);
+                __m128 s2 = _mm_shuffle_ps(st, st, 0x55);
+                y = _mm_add_ps(y, _mm_add_ps(_mm_mul_ps(s1, _mm_load_ps(m.out[0])), _mm_mul_ps(s2, _mm_load_ps(m.out[1]))));
+                st = _mm_add_ps(s, _mm_add_ps(_mm_mul_ps(s1, _mm_load_ps(m.state[0])), _mm_mul_ps(s2, _mm_load_ps(m.state[1]))));
+                _mm_storeu_ps(&out[i], y);
+            }
+            state[0] = _mm_cvtss_f32(st);
+            state[1] = _mm_cvtss_f32(_mm_shuffle_ps(st, st, 0x55));
+            generic::section<1>(&out[i], &in[i], count - i, c, state);
+        }
+
+        // Lanes 0 and 1 hold the two channels, the upper two are unused
+        inline void section2(float* out, const float* in, int count, const biquad& c, float* state) {
+            __m128 b0 = _mm_set1_ps(c.b0);
+            __m128 b1 = _mm_set1_ps(c.b1);
+            __m128 b2 = _mm_set1_ps(c.b2);
+            __m128 a1 = _mm_set1_ps(c.a1);
+            __m128 a2 = _mm_set1_ps(c.a2);
+            __m128 s1 = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&state[0]);
+            __m128 s2 = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&state[2]);
+            for (int i = 0; i < count; i++) {
+                __m128 x = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&in[2 * i]);
+                __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), s1);
+                s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), s2);
+                s2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+                _mm_storel_pi((__m64*)&out[2 * i], y);
+            }
+            _mm_storel_pi((__m64*)&state[0], s1);
+            _mm_storel_pi((__m64*)&state[2], s2);
+        }
+    }
+
+    namespace avx2 {
+        // Blocks of 8, the outputs in one register and the new state in a second one
+        FIR_TARGET_AVX2 inline void section1(float* out, const float* in, int count, const biquad& c, float* state) {
+            lookahead<8> m(c);
+            __m128 st = _mm_setr_ps(state[0], state[1], 0.0f, 0.0f);
+            int i = 0;
+            for (; i + 8 <= count; i += 8) {
+                __m256 ya = _mm256_setzero_ps();
+                __m256 yb = _mm256_setzero_ps();
+                __m128 sa = _mm_setzero_ps();
+                __m128 sb = _mm_setzero_ps();
+                for (int j = 0; j < 8; j += 2) {
+                    __m256 xa = _mm256_broadcast_ss(&in[i + j]);
+                    __m256 xb = _mm256_broadcast_ss(&in[i + j + 1]);
+                    ya = _mm256_fmadd_ps(xa, _mm256_load_ps(m.out[2 + j]), ya);
+                    yb = _mm256_fmadd_ps(xb, _mm256_load_ps(m.out[3 + j]), yb);
+                    sa = _mm_fmadd_ps(_mm256_castps256_ps128(xa), _mm_load_ps(m.state[2 + j]), sa);
+                    sb = _mm_fmadd_ps(_mm256_castps256_ps128(xb), _mm_load_ps(m.state[3 + j]), sb);
+                }
+
+                __m128 s1 = _mm_shuffle_ps(st, st, 0x00);
+                __m128 s2 = _mm_shuffle_ps(st, st, 0x55);
+                __m256 y = _mm256_add_ps(ya, yb);
+                y = _mm256_fmadd_ps(_mm256_set_m128(s1, s1), _mm256_load_ps(m.out[0]), y);
+                y = _mm256_fmadd_ps(_mm256_set_m128(s2, s2), _mm256_load_ps(m.out[1]), y);
+                st = _mm_add_ps(sa, sb);
+                st = _mm_fmadd_ps(s1, _mm_load_ps(m.state[0]), st);
+                st = _mm_fmadd_ps(s2, _mm_load_ps(m.state[1]), st);
+                _mm256_storeu_ps(&out[i], y);
+            }
+            state[0] = _mm_cvtss_f32(st);
+            state[1] = _mm_cvtss_f32(_mm_shuffle_ps(st, st, 0x55));
+            sse::section1(&out[i], &in[i], count - i, c, state);
+        }
+    }
+#endif
+
+#ifdef FIR_KERNELS_NEON
+    namespace neon {
+        inline void section1(float* out, const float* in, int count, const biquad& c, float* state) {
+            lookahead<4> m(c);
+            float32x2_t st = vld1_f32(state);
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                float32x4_t x = vld1q_f32(&in[i]);
+                float32x4_t y = vmulq_laneq_f32(vld1q_f32(m.out[2]), x, 0);
+                y = vfmaq_laneq_f32(y, vld1q_f32(m.out[3]), x, 1);
+                y = vfmaq_laneq_f32(y, vld1q_f32(m.out[4]), x, 2);
+                y = vfmaq_laneq_f32(y, vld1q_f32(m.out[5]), x, 3);
+                float32x2_t s = vmul_laneq_f32(vld1_f32(m.state[2]), x, 0);
+                s = vfma_laneq_f32(s, vld1_f32(m.state[3]), x, 1);
+                s = vfma_laneq_f32(s, vld1_f32(m.state[4]), x, 2);
+                s = vfma_laneq_f32(s, vld1_f32(m.state[5]), x, 3);
+
+                y = vfmaq_lane_f32(y, vld1q_f32(m.out[0]), st, 0);
+                y = vfmaq_lane_f32(y, vld1q_f32(m.out[1]), st, 1);
+                s = vfma_lane_f32(s, vld1_f32(m.state[0]), st, 0);
+                st = vfma_lane_f32(s, vld1_f32(m.state[1]), st, 1);
+                vst1q_f32(&out[i], y);
+            }
+            vst1_f32(state, st);
+            generic::section<1>(&out[i], &in[i], count - i, c, state);
+        }
+
+        inline void section2(float* out, const float* in, int count, const biquad& c, float* state) {
+            float32x2_t s1 = vld1_f32(&state[0]);
+            float32x2_t s2 = vld1_f32(&state[2]);
+            for (int i = 0; i < count; i++) {
+                float32x2_t x = vld1_f32(&in[2 * i]);
+                float32x2_t y = vadd_f32(vmul_n_f32(x, c.b0), s1);
+                s1 = vadd_f32(vsub_f32(vmul_n_f32(x, c.b1), vmul_n_f32(y, c.a1)), s2);
+                s2 = vsub_f32(vmul_n_f32(x, c.b2), vmul_n_f32(y, c.a2));
+                vst1_f32(&out[2 * i], y);
+            }
+            vst1_f32(&state[0], s1);
+            vst1_f32(&state[2], s2);
+        }
+    }
+#endif
+
+    // One section over count samples of float, stereo_t or complex_t data
+    template <class T>
+    inline void section(T* out, const T* in, int count, const biquad& c, float* state) {
+        constexpr int CH = sizeof(T) / sizeof(float);
+        static_assert(CH == 1 || CH == 2, "Unsupported sample type");
+        float* o = (float*)out;
+        const float* x = (const float*)in;
+        if (CH == 1 && poleRadius(c) > 1.0 - IIR_LOOKAHEAD_MIN_MARGIN) {
+            generic::section<CH>(o, x, count, c, state);
+            return;
+        }
+        switch (fir_kernels::getSIMDLevel()) {
+#ifdef FIR_KERNELS_X86
+            case fir_kernels::SIMD_AVX512:
+            case fir_kernels::SIMD_AVX2:
+                if constexpr (CH == 1) { avx2::section1(o, x, count, c, state); }
+                else { sse::section2(o, x, count, c, state); }
+                return;
+            case fir_kernels::SIMD_SSE:
+                if constexpr (CH == 1) { sse::section1(o, x, count, c, state); }
+                else { sse::section2(o, x, count, c, state); }
+                return;
+#endif
+#ifdef FIR_KERNELS_NEON
+            case fir_kernels::SIMD_NEON:
+                if constexpr (CH == 1) { neon::section1(o, x, count, c, state); }
+                else { neon::section2(o, x, count, c, state); }
+                return;
+#endif
+            default:
+                generic::section<CH>(o, x, count, c, state);
+                return;
+        }
+    }
+
+    // Sections one after the other, state holding the states of all of them in a row
+    template <class T>
+    inline void cascade(T* out, const T* in, int count, const biquad* sections, int sectionCount, float* state) {
+        constexpr int STATE_SIZE = 2 * (sizeof(T) / sizeof(float));
+        if (!sectionCount) {
+            if (out != in) { memmove(out, in, count * sizeof(T)); }
+            return;
+        }
+        section(out, in, count, sections[0], state);
+        for (int i = 1; i < sectionCount; i++) {
+            section(out, out, count, sections[i], &state[i * STATE_SIZE]);
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+
+namespace dsp {
+    // Hands parameters from control threads to the thread running a block without stopping it.
+    // Setters post a whole new set, the block picks up the latest one whenever it next checks,
+    // usually at the start of a buffer. Sets posted in between are skipped, the block never
+    // sees a half written one.
+    //
+    // Triple buffer: the control side fills back, the block reads front and the two swap
+    // through middle. Only the control side takes a lock, the block's side is a single load
+    // when nothing changed.
+    template <class T>
+    class param_mailbox {
+    public:
+        // Set the parameters without posting them, must only be called while the block isn't running
+        void reset(const T& params) {
+            std::lock_guard<std::mutex> lck(mtx);
+            staging = params;
+            for (auto& slot : slots) { slot = params; }
+            middle.store(1, std::memory_order_relaxed);
+            back = 0;
+            front = 2;
+        }
+
+        // Modify the latest parameters and post the result, can be called from any thread
+        template <class Func>
+        void update(Func func) {
+            std::lock_guard<std::mutex> lck(mtx);
+            func(staging);
+            slots[back] = staging;
+            back = middle.exchange(back | NEW, std::memory_order_acq_rel) & INDEX;
+        }
+
+        // Latest parameters posted, for getters
+        T get() {
+            std::lock_guard<std::mutex> lck(mtx);
+            return staging;
+        }
+
+        // Called by the block, copies the newest set into params if one was posted since the last call
+        bool fetch(T& params) {
+            if (!(middle.load(std::memory_order_relaxed) & NEW)) { return false; }
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+            params = slots[front];
+            return true;
+        }
+
+    private:
+        static const int INDEX = 3;
+        static const int NEW = 4;
+
+        std::mutex mtx;
+        T staging = {};
+        T slots[3] = {};
+        int back = 0;
+        int front = 2;
+        std::atomic<int> middle{1};
+
+    };
+
+    // Hands whole objects (eg. tap sets) from control threads to the thread running a block.
+    // The block switches to the newest one between buffers. The one it replaced is deleted by
+    // the control side on its next post, or when the mailbox goes away, so the block never
+    // frees memory while running.
+    template <class T>
+    class ptr_mailbox {
+    public:
+        ~ptr_mailbox() {
+            delete current;
+            delete pending.load(std::memory_order_acquire);
+            delete retired.load(std::memory_order_acquire);
+        }
+
+        // Replace everything, must only be called while the block isn't running
+        void reset(T* obj) {
+            delete pending.exchange(NULL, std::memory_order_acq_rel);
+            delete retired.exchange(NULL, std::memory_order_acq_rel);
+            delete current;
+            current = obj;
+        }
+
+        // Control side, takes ownership of obj
+        void post(T* obj) {
+            delete retired.exchange(NULL, std::memory_order_acq_rel);
+
+            // One the block never picked up can go right away
+            delete pending.exchange(obj, std::memory_order_acq_rel);
+        }
+
+        // Called by the block between buffers, true if get() changed
+        bool update() {
+            if (!pending.load(std::memory_order_relaxed)) { return false; }
+            T* obj = pending.exchange(NULL, std::memory_order_acq_rel);
+            if (!obj) { return false; }
+            T* old = current;
+            current = obj;
+
+            // Only happens if two posts made it through before the control side could clean up
+            delete retired.exchange(old, std::memory_order_acq_rel);
+            return true;
+        }
+
+        // Object in use by the block
+        T* get() {
+            return current;
+        }
+
+    private:
+        T* current = NULL;
+        std::atomic<T*> pending{NULL};
+        std::atomic<T*> retired{NULL};
+
+    };
+}
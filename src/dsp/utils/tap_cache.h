@@ -0,0 +1,49 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace dsp {
+    // What a set of taps was designed from: the window type, its parameters and whatever the
+    // taps were turned into afterwards (scaling, polyphase split, quantization...)
+    struct tap_key {
+        std::string kind;
+        std::vector<double> params;
+
+        bool operator<(const tap_key& b) const {
+            return std::tie(kind, params) < std::tie(b.kind, b.params);
+        }
+    };
+
+    // Process wide cache of designed taps. Blocks with the same filter share one immutable copy
+    // instead of each designing their own, which adds up when many channels retune at once.
+    // A copy goes away with the last block using it.
+    namespace tap_cache {
+        // Object cached under key for this type, made by make() if there's none yet. make() runs
+        // under the cache's lock so that the same taps never get designed twice in parallel.
+        template <class T, class Func>
+        std::shared_ptr<const T> get(const tap_key& key, Func make) {
+            static std::mutex mtx;
+            static std::map<tap_key, std::weak_ptr<const T>> entries;
+
+            std::lock_guard<std::mutex> lck(mtx);
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                std::shared_ptr<const T> obj = it->second.lock();
+                if (obj) { return obj; }
+            }
+
+            // Forget the sets nothing uses anymore
+            for (auto e = entries.begin(); e != entries.end();) {
+                e = e->second.expired() ? entries.erase(e) : std::next(e);
+            }
+
+            std::shared_ptr<const T> obj(make());
+            entries[key] = obj;
+            return obj;
+        }
+    }
+}
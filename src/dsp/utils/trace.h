@@ -0,0 +1,193 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <typeinfo>
+#include <stdint.h>
+#include <stdio.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h>
+#include <stdlib.h>
+#endif
+
+// Number of events kept per thread, older ones get overwritten. Must be a power of two.
+#define TRACE_BUFFER_EVENTS     16384
+
+// Opt-in tracer recording the spans of each block's run() and of each wait in a stream.
+// Every thread writes to its own ring without any locking, the rings are only walked
+// when exporting. The result is in the Chrome trace event format, viewable with Perfetto
+// or chrome://tracing.
+//
+// Example:
+//     dsp::trace::enable();
+//     ...
+//     dsp::trace::writeJSON("trace.json");
+namespace dsp::trace {
+    struct event {
+        const char* name;   // Must outlive the tracer, usually a literal or a cached type name
+        const void* id;     // Object the span belongs to
+        uint64_t start;     // ns, steady clock
+        uint64_t duration;  // ns
+    };
+
+    class thread_buffer {
+    public:
+        thread_buffer(int tid) : tid(tid) {
+            events.resize(TRACE_BUFFER_EVENTS);
+        }
+
+        // Only ever called by the owning thread
+        void push(const event& e) {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            events[h & (TRACE_BUFFER_EVENTS - 1)] = e;
+            head.store(h + 1, std::memory_order_release);
+        }
+
+        // Copy of the events still in the ring, any the writer might have overwritten while copying are left out
+        std::vector<event> snapshot() {
+            uint64_t h = head.load(std::memory_order_acquire);
+            uint64_t first = (h > TRACE_BUFFER_EVENTS) ? (h - TRACE_BUFFER_EVENTS) : 0;
+            std::vector<event> copy;
+            copy.reserve(h - first);
+            for (uint64_t i = first; i < h; i++) {
+                copy.push_back(events[i & (TRACE_BUFFER_EVENTS - 1)]);
+            }
+            // Event after is written to the slot of event after - TRACE_BUFFER_EVENTS before head moves on
+            uint64_t after = head.load(std::memory_order_acquire);
+            uint64_t valid = (after >= TRACE_BUFFER_EVENTS) ? (after - TRACE_BUFFER_EVENTS + 1) : 0;
+            if (valid > first) {
+                copy.erase(copy.begin(), copy.begin() + std::min<uint64_t>(valid - first, copy.size()));
+            }
+            return copy;
+        }
+
+        void clear() {
+            head.store(0, std::memory_order_release);
+        }
+
+        const int tid;
+
+    private:
+        std::vector<event> events;
+        std::atomic<uint64_t> head{0};
+
+    };
+
+    class registry {
+    public:
+        static registry& get() {
+            static registry reg;
+            return reg;
+        }
+
+        thread_buffer* local() {
+            // Buffers belong to the registry so that the events of threads that exited can still be exported
+            static thread_local thread_buffer* buf = NULL;
+            if (!buf) {
+                std::lock_guard<std::mutex> lck(mtx);
+                buffers.emplace_back(new thread_buffer(buffers.size() + 1));
+                buf = buffers.back().get();
+            }
+            return buf;
+        }
+
+        std::vector<thread_buffer*> all() {
+            std::lock_guard<std::mutex> lck(mtx);
+            std::vector<thread_buffer*> list;
+            for (auto& b : buffers) {
+                list.push_back(b.get());
+            }
+            return list;
+        }
+
+        std::atomic<bool> enabled{false};
+
+    private:
+        std::mutex mtx;
+        std::vector<std::unique_ptr<thread_buffer>> buffers;
+
+    };
+
+    inline bool isEnabled() {
+        return registry::get().enabled.load(std::memory_order_relaxed);
+    }
+
+    inline void enable() {
+        registry::get().enabled.store(true, std::memory_order_relaxed);
+    }
+
+    inline void disable() {
+        registry::get().enabled.store(false, std::memory_order_relaxed);
+    }
+
+    // Drop all recorded events. Should be done while tracing is disabled.
+    inline void clear() {
+        for (auto& buf : registry::get().all()) {
+            buf->clear();
+        }
+    }
+
+    inline uint64_t toNs(std::chrono::steady_clock::time_point t) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    }
+
+    inline void record(const char* name, const void* id, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+        registry::get().local()->push({ name, id, toNs(start), toNs(end) - toNs(start) });
+    }
+
+    // Readable name of a type, the returned pointer stays valid forever
+    inline const char* typeName(const std::type_info& type) {
+#if defined(__GNUC__) || defined(__clang__)
+        int status;
+        char* name = abi::__cxa_demangle(type.name(), NULL, NULL, &status);
+        if (status == 0 && name) { return name; }
+#endif
+        return type.name();
+    }
+
+    // name as a JSON string, type names may contain quotes or backslashes
+    inline std::string escapeJSON(const char* name) {
+        std::string str = "\"";
+        for (const char* c = name; *c; c++) {
+            if (*c == '"' || *c == '\\') {
+                str += '\\';
+                str += *c;
+            }
+            else if ((unsigned char)*c < 0x20) {
+                char hex[8];
+                snprintf(hex, sizeof(hex), "\\u%04x", (unsigned char)*c);
+                str += hex;
+            }
+            else {
+                str += *c;
+            }
+        }
+        return str + "\"";
+    }
+
+    // Write all the recorded events to a Chrome trace event JSON file
+    inline bool writeJSON(std::string path) {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f) { return false; }
+
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        bool first = true;
+        for (auto& buf : registry::get().all()) {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"dsp thread %d\"}}", first ? "" : ",\n", buf->tid, buf->tid);
+            first = false;
+            for (auto& e : buf->snapshot()) {
+                fprintf(f, ",\n{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3lf,\"dur\":%.3lf,\"args\":{\"id\":\"%p\"}}",
+                        escapeJSON(e.name).c_str(), buf->tid, (double)e.start / 1000.0, (double)e.duration / 1000.0, e.id);
+            }
+        }
+        fprintf(f, "\n]}\n");
+
+        fclose(f);
+        return true;
+    }
+}
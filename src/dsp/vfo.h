@@ -5,6 +5,9 @@
 #include <dsp/processing.h>
 #include <algorithm>
 
+// Narrowest transition band CICVFO gives its compensation filter, relative to the output rate
+#define CIC_VFO_MIN_TRANSITION  0.1f
+
 namespace dsp {
     class VFO {
     public:
@@ -109,4 +112,91 @@ namespace dsp {
         PolyphaseResampler<complex_t> resamp;
 
     };
+
+    // VFO for large integer decimations of wideband input. The translated input goes through a
+    // CIC decimator, then a short FIR flattens the CIC's droop and, when decim is even, does
+    // the last decimation by 2 so that its transition band can reach up to the aliases.
+    // The output rate is inSampleRate / decim. With complex_int16 input, everything up to the
+    // CIC's output stays in fixed point.
+    template <class T>
+    class CICVFO {
+    public:
+        CICVFO() {}
+
+        ~CICVFO() { stop(); }
+
+        CICVFO(stream<T>* in, float offset, float inSampleRate, int decim, float bandWidth, int order = 4) {
+            init(in, offset, inSampleRate, decim, bandWidth, order);
+        }
+
+        void init(stream<T>* in, float offset, float inSampleRate, int decim, float bandWidth, int order = 4) {
+            _in = in;
+            _offset = offset;
+            _inSampleRate = inSampleRate;
+            _bandWidth = bandWidth;
+            firDecim = (decim % 2 == 0 && decim >= 4) ? 2 : 1;
+
+            xlator.init(_in, _inSampleRate, -_offset);
+            cic.init(&xlator.out, decim / firDecim, order);
+            designWindow();
+            comp.init(&cic.out, &win, firDecim);
+
+            out = &comp.out;
+        }
+
+        void start() {
+            if (running) { return; }
+            xlator.start();
+            cic.start();
+            comp.start();
+            running = true;
+        }
+
+        void stop() {
+            if (!running) { return; }
+            xlator.stop();
+            cic.stop();
+            comp.stop();
+            running = false;
+        }
+
+        void setOffset(float offset) {
+            _offset = offset;
+            xlator.setFrequency(-_offset);
+        }
+
+        void setBandwidth(float bandWidth) {
+            _bandWidth = bandWidth;
+            designWindow();
+            comp.updateWindow(&win);
+        }
+
+        float getOutSampleRate() {
+            return _inSampleRate / (float)(cic.getDecimation() * firDecim);
+        }
+
+        stream<complex_t>* out;
+
+    private:
+        void designWindow() {
+            float cicRate = _inSampleRate / (float)cic.getDecimation();
+            float outRate = cicRate / (float)firDecim;
+            float cutoff = std::min<float>(_bandWidth, outRate) / 2.0f;
+
+            // Past the edge, the FIR's decimation would alias into the passband, or the CIC's output ends
+            float stopEdge = (firDecim == 2) ? (outRate - cutoff) : (cicRate / 2.0f);
+            float transWidth = std::max<float>(stopEdge - cutoff, outRate * CIC_VFO_MIN_TRANSITION);
+            win.init(cic.getOrder(), cic.getDecimation(), cic.getDelay(), cutoff, transWidth, cicRate);
+        }
+
+        bool running = false;
+        float _offset, _inSampleRate, _bandWidth;
+        int firDecim;
+        CICCompensationTaps win;
+        stream<T>* _in;
+        FrequencyXlator<T> xlator;
+        CICDecimator<T> cic;
+        DecimatingFIR<complex_t> comp;
+
+    };
 }
\ No newline at end of file
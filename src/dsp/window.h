@@ -1,6 +1,16 @@
 #pragma once
 #include <dsp/block.h>
 #include <dsp/types.h>
+#include <dsp/utils/fir_kernels.h>
+#include <dsp/utils/tap_cache.h>
+#include <vector>
+#include <algorithm>
+
+// Smallest CIC gain CICCompensationTaps inverts, caps the boost near the CIC's nulls
+#define CIC_COMP_MIN_RESPONSE   0.01
+
+// Correction passes CICCompensationTaps makes on the passband it samples
+#define CIC_COMP_PASSES         4
 
 namespace dsp {
     namespace filter_window {
@@ -8,6 +18,18 @@ namespace dsp {
         public:
             virtual int getTapCount() { return -1; }
             virtual void createTaps(float* taps, int tapCount, float factor = 1.0f) {}
+
+            // Everything the taps depend on, windows that return false don't get their taps cached
+            virtual bool getDesignKey(tap_key& key) { return false; }
+
+            // Real windows just give their taps with a zero imaginary part
+            virtual void createComplexTaps(complex_t* taps, int tapCount, float factor = 1.0f) {
+                std::vector<float> real(tapCount);
+                createTaps(real.data(), tapCount, factor);
+                for (int i = 0; i < tapCount; i++) {
+                    taps[i] = { real[i], 0.0f };
+                }
+            }
         };
 
         class BlackmanWindow : public filter_window::generic_window {
@@ -49,18 +71,26 @@ namespace dsp {
                 return _M;
             }
 
+            bool getDesignKey(tap_key& key) {
+                key = { "blackman", { _cutoff, _transWidth, _sampleRate } };
+                return true;
+            }
+
             void createTaps(float* taps, int tapCount, float factor = 1.0f) {
                 float fc = _cutoff / _sampleRate;
                 if (fc > 1.0f) {
                     fc = 1.0f;
                 }
-                float tc = tapCount;
+                // Centered on the middle tap so that the taps are symmetric, the window leaves out its zero ends
+                float half = (float)(tapCount - 1) / 2.0f;
                 float sum = 0.0f;
                 float val;
                 for (int i = 0; i < tapCount; i++) {
-                    val = (sin(2.0f * FL_M_PI * fc * ((float)i - (tc / 2))) / ((float)i - (tc / 2))) * 
-                        (0.42f - (0.5f * cos(2.0f * FL_M_PI / tc)) + (0.8f * cos(4.0f * FL_M_PI / tc)));
-                    taps[i] = val; // tapCount - i - 1
+                    float t = (float)i - half;
+                    val = (t == 0.0f) ? (2.0f * FL_M_PI * fc) : (sin(2.0f * FL_M_PI * fc * t) / t);
+                    float pos = (float)(i + 1) / (float)(tapCount + 1);
+                    val *= 0.42f - (0.5f * cos(2.0f * FL_M_PI * pos)) + (0.08f * cos(4.0f * FL_M_PI * pos));
+                    taps[i] = val;
                     sum += val;
                 }
                 for (int i = 0; i < tapCount; i++) {
@@ -118,18 +148,26 @@ namespace dsp {
                 return _M;
             }
 
+            bool getDesignKey(tap_key& key) {
+                key = { "blackman_bandpass", { _cutoff, _transWidth, _offset, _sampleRate } };
+                return true;
+            }
+
             void createTaps(float* taps, int tapCount, float factor = 1.0f) {
                 float fc = _cutoff / _sampleRate;
                 if (fc > 1.0f) {
                     fc = 1.0f;
                 }
-                float tc = tapCount;
+                // Centered on the middle tap so that the taps are symmetric, the window leaves out its zero ends
+                float half = (float)(tapCount - 1) / 2.0f;
                 float sum = 0.0f;
                 float val;
                 for (int i = 0; i < tapCount; i++) {
-                    val = (sin(2.0f * FL_M_PI * fc * ((float)i - (tc / 2))) / ((float)i - (tc / 2))) * 
-                        (0.42f - (0.5f * cos(2.0f * FL_M_PI / tc)) + (0.8f * cos(4.0f * FL_M_PI / tc)));
-                    taps[i] = val; // tapCount - i - 1
+                    float t = (float)i - half;
+                    val = (t == 0.0f) ? (2.0f * FL_M_PI * fc) : (sin(2.0f * FL_M_PI * fc * t) / t);
+                    float pos = (float)(i + 1) / (float)(tapCount + 1);
+                    val *= 0.42f - (0.5f * cos(2.0f * FL_M_PI * pos)) + (0.08f * cos(4.0f * FL_M_PI * pos));
+                    taps[i] = val;
                     sum += val;
                 }
                 for (int i = 0; i < tapCount; i++) {
@@ -139,6 +177,18 @@ namespace dsp {
                 }
             }
 
+            // Lowpass shifted by offset only, passes the band on one side of DC.
+            // Filters dot the taps with the oldest sample first, so the rotation runs backwards.
+            void createComplexTaps(complex_t* taps, int tapCount, float factor = 1.0f) {
+                BlackmanWindow lowpass(_cutoff, _transWidth, _sampleRate);
+                std::vector<float> real(tapCount);
+                lowpass.createTaps(real.data(), tapCount, factor);
+                for (int i = 0; i < tapCount; i++) {
+                    float phase = -2.0f * (_offset / _sampleRate) * FL_M_PI * (float)i;
+                    taps[i] = { real[i] * cosf(phase), real[i] * sinf(phase) };
+                }
+            }
+
         private:
             float _cutoff, _transWidth, _sampleRate, _offset;
 
@@ -158,8 +208,9 @@ namespace dsp {
                 _alpha = alpha;
             }
 
+            // The design needs a center tap
             int getTapCount() {
-                return _tapCount;
+                return _tapCount | 1;
             }
 
             void setSampleRate(float sampleRate) {
@@ -178,10 +229,13 @@ namespace dsp {
                 _alpha = alpha;
             }
 
+            bool getDesignKey(tap_key& key) {
+                key = { "rrc", { (double)_tapCount, _sampleRate, _baudRate, _alpha } };
+                return true;
+            }
+
             void createTaps(float* taps, int tapCount, float factor = 1.0f) {
                 // ======== CREDIT: GNU Radio =========
-                tapCount |= 1; // ensure that tapCount is odd
-
                 double spb = _sampleRate / _baudRate; // samples per bit/symbol
                 double scale = 0;
                 for (int i = 0; i < tapCount; i++)
@@ -229,4 +283,282 @@ namespace dsp {
             float _sampleRate, _baudRate, _alpha;
 
         };
-}
\ No newline at end of file
+
+    // Impulse response of a CIC filter changing the rate by rate, ie. order boxcars of
+    // rate * delay samples convolved together. Gives the non recursive form of the CIC.
+    class CICTaps : public filter_window::generic_window {
+        public:
+            CICTaps() {}
+            CICTaps(int order, int rate, int delay = 1) { init(order, rate, delay); }
+
+            void init(int order, int rate, int delay = 1) {
+                _order = order;
+                _rate = rate;
+                _delay = delay;
+            }
+
+            int getTapCount() {
+                return (_order * ((_rate * _delay) - 1)) + 1;
+            }
+
+            bool getDesignKey(tap_key& key) {
+                key = { "cic", { (double)_order, (double)_rate, (double)_delay } };
+                return true;
+            }
+
+            void createTaps(float* taps, int tapCount, float factor = 1.0f) {
+                // The counts get far too large for floats, (rate * delay)^order
+                size_t len = _rate * _delay;
+                std::vector<double> resp(1, 1.0);
+                for (int n = 0; n < _order; n++) {
+                    std::vector<double> next(resp.size() + len - 1, 0.0);
+                    double run = 0.0;
+                    for (size_t i = 0; i < next.size(); i++) {
+                        if (i < resp.size()) { run += resp[i]; }
+                        if (i >= len) { run -= resp[i - len]; }
+                        next[i] = run;
+                    }
+                    resp = std::move(next);
+                }
+
+                double sum = 0.0;
+                for (auto& val : resp) { sum += val; }
+                for (int i = 0; i < tapCount; i++) {
+                    taps[i] = ((size_t)i < resp.size()) ? (float)(resp[i] * factor / sum) : 0.0f;
+                }
+            }
+
+        private:
+            int _order, _rate, _delay;
+
+        };
+
+    // Lowpass for the output of a CIC decimator that also flattens the CIC's droop. The
+    // CIC's response is inverted up to cutoff, then tapers to zero over transWidth. The
+    // taps are that response sampled back into time, with a Blackman window.
+    // sampleRate is the CIC's output rate.
+    class CICCompensationTaps : public filter_window::generic_window {
+        public:
+            CICCompensationTaps() {}
+            CICCompensationTaps(int order, int decim, int delay, float cutoff, float transWidth, float sampleRate) {
+                init(order, decim, delay, cutoff, transWidth, sampleRate);
+            }
+
+            void init(int order, int decim, int delay, float cutoff, float transWidth, float sampleRate) {
+                _order = order;
+                _decim = decim;
+                _delay = delay;
+                _cutoff = cutoff;
+                _transWidth = transWidth;
+                _sampleRate = sampleRate;
+            }
+
+            void setCutoff(float cutoff) {
+                _cutoff = cutoff;
+            }
+
+            void setTransWidth(float transWidth) {
+                _transWidth = transWidth;
+            }
+
+            void setSampleRate(float sampleRate) {
+                _sampleRate = sampleRate;
+            }
+
+            int getTapCount() {
+                int _M = 4.0f / (_transWidth / _sampleRate);
+                if (_M < 4) {
+                    _M = 4;
+                }
+
+                if (_M % 2 == 0) { _M++; }
+
+                return _M;
+            }
+
+            bool getDesignKey(tap_key& key) {
+                key = { "cic_compensation", { (double)_order, (double)_decim, (double)_delay, _cutoff, _transWidth, _sampleRate } };
+                return true;
+            }
+
+            void createTaps(float* taps, int tapCount, float factor = 1.0f) {
+                double fc = _cutoff / _sampleRate;
+                double fs = (_cutoff + _transWidth) / _sampleRate;
+                double half = (double)(tapCount - 1) / 2.0;
+
+                // Response to sample into time, on a grid for the midpoint rule
+                int gridSize = 16 * tapCount;
+                double df = 0.5 / (double)gridSize;
+                std::vector<double> target(gridSize);
+                for (int k = 0; k < gridSize; k++) {
+                    double f = (k + 0.5) * df;
+                    double gain = 0.0;
+                    if (f < fs) {
+                        gain = 1.0 / std::max<double>(cicResponse(std::min<double>(f, fc)), CIC_COMP_MIN_RESPONSE);
+                        if (f > fc) { gain *= 0.5 + (0.5 * cos(FL_M_PI * (f - fc) / (fs - fc))); }
+                    }
+                    target[k] = gain;
+                }
+
+                // The window smooths the response, which eats into the edge of the passband.
+                // Each pass scales the sampled passband by how far the result missed it.
+                std::vector<double> want = target;
+                std::vector<double> win(tapCount);
+                std::vector<double> val(tapCount);
+                for (int i = 0; i < tapCount; i++) {
+                    double pos = (double)(i + 1) / (double)(tapCount + 1);
+                    win[i] = 0.42 - (0.5 * cos(2.0 * FL_M_PI * pos)) + (0.08 * cos(4.0 * FL_M_PI * pos));
+                }
+                for (int pass = 0; pass <= CIC_COMP_PASSES; pass++) {
+                    for (int i = 0; i < tapCount; i++) {
+                        double t = (double)i - half;
+                        double sum = 0.0;
+                        for (int k = 0; k < gridSize; k++) {
+                            sum += want[k] * cos(2.0 * FL_M_PI * (k + 0.5) * df * t);
+                        }
+                        val[i] = 2.0 * df * sum * win[i];
+                    }
+                    if (pass == CIC_COMP_PASSES) { break; }
+
+                    for (int k = 0; k < gridSize && (k + 0.5) * df <= fc; k++) {
+                        double f = (k + 0.5) * df;
+                        double resp = 0.0;
+                        for (int i = 0; i < tapCount; i++) {
+                            resp += val[i] * cos(2.0 * FL_M_PI * f * ((double)i - half));
+                        }
+                        if (resp > 0.0) { want[k] *= target[k] / resp; }
+                    }
+                }
+
+                double sum = 0.0;
+                for (int i = 0; i < tapCount; i++) { sum += val[i]; }
+                for (int i = 0; i < tapCount; i++) {
+                    taps[i] = val[i] * factor / sum;
+                }
+            }
+
+        private:
+            // Gain of the CIC at f, relative to its output rate
+            double cicResponse(double f) {
+                if (f == 0.0) { return 1.0; }
+                double num = sin(FL_M_PI * _delay * f);
+                double den = (double)(_decim * _delay) * sin(FL_M_PI * f / (double)_decim);
+                return pow(fabs(num / den), _order);
+            }
+
+            int _order, _decim, _delay;
+            float _cutoff, _transWidth, _sampleRate;
+
+        };
+
+    // Taps designed from a window, immutable once made and shared through tap_cache. TapT is
+    // float, complex_t or int16_t, the latter holding fixed point taps for fir_kernels::dotFixed().
+    template <class TapT>
+    struct designed_taps {
+        designed_taps(int count) : count(count) {
+            int len = std::is_same_v<TapT, int16_t> ? (2 * count) : count;
+            taps = (TapT*)volk_malloc(len * sizeof(TapT), volk_get_alignment());
+        }
+
+        ~designed_taps() {
+            volk_free(taps);
+        }
+
+        TapT* taps;
+        int count;
+        bool symmetric = false;     // Can use fir_kernels::symmetric()
+        int shift = 0;              // Fixed point only, see fir_kernels::fixedTapShift()
+    };
+
+    // Taps of window scaled by factor, taken from the cache if the same ones were designed before
+    template <class TapT = float>
+    std::shared_ptr<const designed_taps<TapT>> designTaps(filter_window::generic_window* window, float factor = 1.0f) {
+        auto make = [=]() {
+            int count = window->getTapCount();
+            designed_taps<TapT>* set = new designed_taps<TapT>(count);
+            if constexpr (std::is_same_v<TapT, float>) {
+                window->createTaps(set->taps, count, factor);
+                set->symmetric = fir_kernels::isSymmetric(set->taps, count);
+            }
+            else if constexpr (std::is_same_v<TapT, complex_t>) {
+                window->createComplexTaps(set->taps, count, factor);
+            }
+            else {
+                std::vector<float> real(count);
+                window->createTaps(real.data(), count, factor);
+                set->shift = fir_kernels::fixedTapShift(real.data(), count);
+                fir_kernels::packFixedTaps(set->taps, real.data(), count, set->shift);
+            }
+            return set;
+        };
+
+        tap_key key;
+        if (!window->getDesignKey(key)) { return std::shared_ptr<const designed_taps<TapT>>(make()); }
+        key.params.push_back(factor);
+        key.params.push_back(window->getTapCount());
+        return tap_cache::get<designed_taps<TapT>>(key, make);
+    }
+
+    // Taps of a filter, replaced as a whole so that the filter can keep running while they change.
+    // The taps themselves are shared with every other filter designed from the same window.
+    template <class TapT>
+    struct basic_tap_set {
+        basic_tap_set(filter_window::generic_window* window, float factor = 1.0f) : design(designTaps<TapT>(window, factor)) {
+            taps = design->taps;
+            count = design->count;
+            symmetric = design->symmetric;
+            shift = design->shift;
+        }
+
+        std::shared_ptr<const designed_taps<TapT>> design;
+        const TapT* taps;
+        int count;
+        bool symmetric;
+        int shift;
+    };
+
+    typedef basic_tap_set<float> tap_set;
+
+    // Same for complex_int16 data, quantized for fir_kernels::dotFixed()
+    typedef basic_tap_set<int16_t> fixed_tap_set;
+
+    // Taps split into one filter per phase of an interp times interpolation. Phase p holds
+    // taps interp - 1 - p, 2 * interp - 1 - p, ... so that the latest input gets the last tap.
+    struct polyphase_taps {
+        ~polyphase_taps() {
+            for (auto& phase : phases) {
+                volk_free(phase);
+            }
+        }
+
+        std::vector<float*> phases;
+        int tapsPerPhase;
+    };
+
+    // Polyphase split of the taps of window scaled by interp, cached like designTaps()
+    inline std::shared_ptr<const polyphase_taps> designPolyphaseTaps(filter_window::generic_window* window, int interp) {
+        auto make = [=]() {
+            std::shared_ptr<const designed_taps<float>> design = designTaps<float>(window, interp);
+            polyphase_taps* set = new polyphase_taps;
+            set->tapsPerPhase = (design->count + interp - 1) / interp;
+            for (int i = 0; i < interp; i++) {
+                set->phases.push_back((float*)volk_malloc(set->tapsPerPhase * sizeof(float), volk_get_alignment()));
+            }
+
+            int currentTap = 0;
+            for (int tap = 0; tap < set->tapsPerPhase; tap++) {
+                for (int phase = 0; phase < interp; phase++) {
+                    set->phases[(interp - 1) - phase][tap] = (currentTap < design->count) ? design->taps[currentTap] : 0.0f;
+                    currentTap++;
+                }
+            }
+            return set;
+        };
+
+        tap_key key;
+        if (!window->getDesignKey(key)) { return std::shared_ptr<const polyphase_taps>(make()); }
+        key.params.push_back(interp);
+        key.params.push_back(window->getTapCount());
+        return tap_cache::get<polyphase_taps>(key, make);
+    }
+}
@@ -17,16 +17,21 @@
 
 #include <dsp/noaa/hrpt.h>
 #include <dsp/noaa/tip.h>
+#include <dsp/scheduler.h>
 
 std::ifstream inputFile("D:/basebands/n19felix.raw16", std::ios::binary);
 
-dsp::stream<uint8_t> packedIn;
+// One HRPT frame per buffer
+dsp::stream<uint8_t> packedIn(STREAM_DEFAULT_DEPTH, 13863);
 dsp::noaa::HRPTDemux demux(&packedIn);
 
 dsp::noaa::TIPDemux tipDemux(&demux.TIPOut);
 
 dsp::noaa::HIRSDemux hirsDemux(&tipDemux.HIRSOut);
 
+// Sinks only ever wait on their input, no need for a thread each
+dsp::ThreadPoolScheduler sinkPool;
+
 dsp::FileSink<uint8_t> aipSink(&demux.AIPOut, "dumps/aip.bin");
 dsp::FileSink<uint16_t> avhrr1Sink(&demux.AVHRRChan1Out, "dumps/avhrr1.bin");
 dsp::FileSink<uint16_t> avhrr2Sink(&demux.AVHRRChan2Out, "dumps/avhrr2.bin");
@@ -77,7 +82,7 @@ void inWorker() {
         }
         packedIn.swap(13863);
     }
-    printf("Done!\n");
+    packedIn.sendEOS();
 }
 
 int main() {
@@ -85,6 +90,43 @@ int main() {
     tipDemux.start();
     hirsDemux.start();
 
+    sinkPool.init();
+    sinkPool.start();
+    dsp::generic_unnamed_block* sinks[] = {
+        &aipSink,
+        &avhrr1Sink,
+        &avhrr2Sink,
+        &avhrr3Sink,
+        &avhrr4Sink,
+        &avhrr5Sink,
+        &semSink,
+        &dcsSink,
+        &sbuvSink,
+        &hirs1Sink,
+        &hirs2Sink,
+        &hirs3Sink,
+        &hirs4Sink,
+        &hirs5Sink,
+        &hirs6Sink,
+        &hirs7Sink,
+        &hirs8Sink,
+        &hirs9Sink,
+        &hirs10Sink,
+        &hirs11Sink,
+        &hirs12Sink,
+        &hirs13Sink,
+        &hirs14Sink,
+        &hirs15Sink,
+        &hirs16Sink,
+        &hirs17Sink,
+        &hirs18Sink,
+        &hirs19Sink,
+        &hirs20Sink
+    };
+    for (auto& sink : sinks) {
+        sink->setScheduler(&sinkPool);
+    }
+
     // HRPT Sinks
     aipSink.start();
     avhrr1Sink.start();
@@ -120,11 +162,27 @@ int main() {
     hirs19Sink.start();
     hirs20Sink.start();
 
+    auto start = std::chrono::steady_clock::now();
     std::thread worker(inWorker);
 
     printf("Started\n");
 
-    while(1);
+    // Let the end of the file flow through the whole graph
+    worker.join();
+    demux.wait();
+    tipDemux.wait();
+    hirsDemux.wait();
+    for (auto& sink : sinks) {
+        sink->wait();
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Done in %lf s\n", elapsed);
+
+    for (auto& sink : sinks) {
+        sink->stop();
+    }
+    sinkPool.stop();
 
     return 0;
 }
\ No newline at end of file